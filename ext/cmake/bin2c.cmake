@@ -0,0 +1,13 @@
+# Converts a binary file to a C source file that defines an array of its
+# bytes, and the size of the array.
+#
+# Usage:
+#   cmake -DINPUT=<file> -DOUTPUT=<source.c> -DNAME=<identifier> -P bin2c.cmake
+
+FILE(READ ${INPUT} filedata HEX)
+STRING(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," filedata ${filedata})
+GET_FILENAME_COMPONENT(input_name ${INPUT} NAME)
+FILE(WRITE ${OUTPUT}
+        "/* Generated from ${input_name}. */\n\n"
+        "const unsigned char ${NAME}[] = {${filedata}};\n"
+        "const unsigned long ${NAME}_len = sizeof(${NAME});\n")
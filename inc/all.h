@@ -8,3 +8,7 @@ enum {
     HAIYAJAN_LOG_CATEGORY_CACHE,
     HAIYAJAN_LOG_CATEGORY_FONT
 };
+
+/* Organisation and application names used to locate the preference path. */
+#define HAIYAJAN_PREF_ORG	"Deltabeard"
+#define HAIYAJAN_PREF_APP	"Haiyajan"
@@ -24,6 +24,13 @@ typedef Uint32 Hash;
 # define PRIhashX "08" SDL_PRIX32
 #endif
 
+/* Default amount of video memory, in bytes, that cached textures may use before
+ * the least recently used textures are evicted. May be overridden at compile
+ * time for devices with little video memory. */
+#ifndef CACHE_DEFAULT_BUDGET
+# define CACHE_DEFAULT_BUDGET (32 * 1024 * 1024)
+#endif
+
 typedef enum {
 	UI_TEXTURE_PART_LABEL,
 	UI_TEXTURE_PART_ICON
@@ -31,21 +38,178 @@ typedef enum {
 
 typedef struct cache_ctx cache_ctx_s;
 
+/**
+ * Writes each cached bitmap to a QOI file in the working directory. Each
+ * atlas page is read back from video memory once, and the bitmaps are then
+ * encoded and written by worker threads, so that a dump may be taken during a
+ * session without stalling rendering for long. A dump that is still being
+ * written when the cache is deinitialised is waited for.
+ *
+ * \param ctx	Cache context.
+ * \param r	Renderer that the cache was initialised with.
+ */
 void dump_cache(cache_ctx_s *ctx, SDL_Renderer *r);
 
-HEDLEY_NON_NULL(1,4)
+/**
+ * Looks up the cached bitmap for part of a UI element. Bitmaps are held within
+ * shared atlas textures, so the bitmap must be drawn using the returned source
+ * rectangle.
+ *
+ * \param ctx	Cache context.
+ * \param content_key	Key identifying the content of the bitmap, as
+ *			given to get_shared_texture(). Bitmaps cached for
+ *			the element with other content are not returned.
+ * \param src	Set to the location of the bitmap within the returned texture.
+ * \return	Atlas texture holding the bitmap, or NULL if not cached.
+ */
+HEDLEY_NON_NULL(1,4,6)
 SDL_Texture *get_cached_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
 	ui_texture_part_e part,
-	Hash label_hash, const struct ui_element *HEDLEY_RESTRICT el);
+	Hash label_hash, const struct ui_element *HEDLEY_RESTRICT el,
+	Uint64 content_key, SDL_Rect *HEDLEY_RESTRICT src);
+
+/**
+ * Looks up a bitmap with identical content that is cached for any element,
+ * and shares it with part of the given element. Should be called when
+ * get_cached_texture() misses, before the bitmap is rendered.
+ *
+ * \param ctx		Cache context.
+ * \param content_key	Key identifying the content and rendering parameters of
+ *			the bitmap, such as the text, font, point size and DPI.
+ * \param src		Set to the location of the bitmap within the returned
+ *			texture.
+ * \return		Atlas texture holding the bitmap, or NULL if no bitmap
+ *			with the same content is cached.
+ */
+HEDLEY_NON_NULL(1,4,6)
+SDL_Texture *get_shared_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
+	ui_texture_part_e part,
+	Hash label_hash, const struct ui_element *HEDLEY_RESTRICT el,
+	Uint64 content_key, SDL_Rect *HEDLEY_RESTRICT src);
 
-HEDLEY_NON_NULL(1,4,5)
-void store_cached_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
+/**
+ * Copies a rendered surface into the cache. The surface is not freed. The
+ * bitmap may be shared with other elements by get_shared_texture().
+ *
+ * \param ctx		Cache context.
+ * \param content_key	Key identifying the content of the bitmap.
+ * \param surf		Rendered surface.
+ * \param src		Set to the location of the bitmap within the returned
+ *			texture.
+ * \return		Atlas texture holding the bitmap, or NULL on error.
+ */
+HEDLEY_NON_NULL(1,4,6,7)
+SDL_Texture *store_cached_surface(cache_ctx_s *HEDLEY_RESTRICT ctx,
 	ui_texture_part_e part,
 	Hash label_hash, const struct ui_element *HEDLEY_RESTRICT el,
-	SDL_Texture *HEDLEY_RESTRICT tex);
+	Uint64 content_key, SDL_Surface *HEDLEY_RESTRICT surf,
+	SDL_Rect *HEDLEY_RESTRICT src);
 
-cache_ctx_s *init_cached_texture(void);
+/**
+ * Loads a pack of previously rendered bitmaps, so that bitmaps do not have to
+ * be rendered again after the application is restarted. The pack is saved to
+ * the same path by save_texture_pack(). A missing or incompatible pack is
+ * ignored.
+ *
+ * \param ctx	Cache context.
+ * \param path	Location of the pack file.
+ */
+void load_texture_pack(cache_ctx_s *ctx, const char *path);
+
+/**
+ * Obtains a bitmap from the texture pack.
+ *
+ * \param ctx	Cache context.
+ * \param key	Key identifying the content and rendering parameters of the
+ *		bitmap, such as the font, point size and DPI.
+ * \return	Decoded bitmap, or NULL if the bitmap is not in the pack. The
+ *		surface must be freed with SDL_FreeSurface().
+ */
+HEDLEY_NON_NULL(1)
+SDL_Surface *get_packed_surface(cache_ctx_s *ctx, Uint64 key);
+
+/**
+ * Adds a rendered bitmap to the texture pack. The surface is not freed.
+ */
+HEDLEY_NON_NULL(1,3)
+void store_packed_surface(cache_ctx_s *HEDLEY_RESTRICT ctx, Uint64 key,
+	SDL_Surface *HEDLEY_RESTRICT surf);
+
+/**
+ * Saves the texture pack if new bitmaps were added since it was loaded.
+ */
+void save_texture_pack(cache_ctx_s *ctx);
+
+/**
+ * Initialise a new cache context.
+ *
+ * \param rend	Renderer used to create atlas textures.
+ * \return	Cache context, or NULL on error.
+ */
+cache_ctx_s *init_cached_texture(SDL_Renderer *rend);
+
+/**
+ * Sets the generation of font sizes that bitmaps are looked up and stored
+ * with. Entries of other generations are retained until they are evicted, so
+ * that returning to previous font sizes, such as when moving the window back
+ * to a monitor with a different DPI, does not require bitmaps to be rendered
+ * again.
+ *
+ * \param ctx		Cache context.
+ * \param generation	Value identifying the font sizes and DPI in use.
+ */
+void set_cached_texture_generation(cache_ctx_s *ctx, Uint32 generation);
+
+/**
+ * Obtains statistics of the cache.
+ *
+ * \param ctx	Cache context.
+ * \param stats	Set to the current statistics.
+ */
+HEDLEY_NON_NULL(1,2)
+void get_cache_stats(const cache_ctx_s *HEDLEY_RESTRICT ctx,
+	struct ui_cache_stats *HEDLEY_RESTRICT stats);
+
+/**
+ * Sets the amount of video memory that cached textures may use. If the atlas
+ * pages exceed the new budget, whole pages are evicted immediately and their
+ * textures are destroyed by the next call to destroy_retired_textures().
+ *
+ * \param ctx	Cache context.
+ * \param bytes	Budget in bytes.
+ */
+void set_cached_texture_budget(cache_ctx_s *ctx, size_t bytes);
 
 void deinit_cached_texture(cache_ctx_s *ctx);
 
+/**
+ * Removes all textures from the cache. The textures are retired, and are
+ * destroyed on the next call to destroy_retired_textures().
+ */
 void clear_cached_textures(cache_ctx_s *ctx);
+
+/**
+ * Destroys textures that were removed from the cache. Must be called once per
+ * frame, before drawing begins, so that textures are never destroyed whilst
+ * they may be used within the frame that is being drawn.
+ */
+void destroy_retired_textures(cache_ctx_s *ctx);
+
+/**
+ * Obtains a render target texture, reusing a recycled texture of the same
+ * format and size where possible.
+ *
+ * \param ctx	Cache context.
+ * \param rend	Renderer to create the texture with.
+ * \return	Texture, or NULL on error (check SDL_GetError()).
+ */
+HEDLEY_NON_NULL(1,2)
+SDL_Texture *acquire_target_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
+	SDL_Renderer *HEDLEY_RESTRICT rend, Uint32 format, int w, int h);
+
+/**
+ * Returns a render target texture to the pool so that it may be reused by
+ * acquire_target_texture(). The least recently recycled texture is retired if
+ * the pool is full.
+ */
+void recycle_target_texture(cache_ctx_s *ctx, SDL_Texture *tex);
@@ -45,23 +45,135 @@ typedef enum
  * \param ctx	Font context.
  * \param icon	UTF-16 glyph.
  * \param fg	Colour of glyph to render.
- * \return	Rendered glyph in texture, or NULL on error (check SDL_GetError()).
+ * \return	Rendered glyph in surface, or NULL on error (check SDL_GetError()).
+ *		The surface must be freed with SDL_FreeSurface().
 */
-SDL_Texture *font_render_icon(font_ctx_s *ctx, Uint16 icon, SDL_Colour fg);
+SDL_Surface *font_render_icon(font_ctx_s *ctx, Uint16 icon, SDL_Colour fg);
 
 /**
  * Renders the UTF-8 string str given the font style s, rendering quality q,
- * and the font colour fg.
+ * and the font colour fg. Text wider than max_w, or than the largest texture,
+ * is truncated to end with an ellipsis.
  *
  * \param ctx	Font context.
  * \param str	UTF-8 string.
  * \param s	Style of font.
  * \param q	Quality of rendering. Low quality is fast but ugly.
  * \param fg	Font colour.
- * \return	Rendered string in texture, or NULL on error (check SDL_GetError()).
+ * \param max_w	Width in pixels to truncate the text to, or 0 to only
+ *		truncate text that is too wide for a texture.
+ * \return	Rendered string in surface, or NULL on error (check SDL_GetError()).
+ *		The surface must be freed with SDL_FreeSurface().
 */
-SDL_Texture *font_render_text(font_ctx_s *ctx, const char *str,
-	font_style_e s, font_quality_e q, SDL_Colour fg);
+SDL_Surface *font_render_text(font_ctx_s *ctx, const char *str,
+	font_style_e s, font_quality_e q, SDL_Colour fg, int max_w);
+
+/**
+ * Draws the UTF-8 string str to the current render target using glyphs cached
+ * within a texture atlas. Only glyphs that are not already cached are
+ * rendered, so this is much faster than font_render_text() for text that
+ * changes frequently.
+ *
+ * \param ctx	Font context.
+ * \param str	UTF-8 string.
+ * \param s	Style of font.
+ * \param fg	Font colour.
+ * \param x	Position of the left edge of the text.
+ * \param y	Position of the top edge of the text.
+ * \param dim	Set to the area that the text was drawn within. May be NULL.
+ * \return	0 on success, or -1 if the string requires bidirectional
+ *		reordering, in which case it must be rendered with
+ *		font_render_text() instead.
+ */
+int font_draw_text(font_ctx_s *ctx, const char *str, font_style_e s,
+	SDL_Colour fg, int x, int y, SDL_Rect *dim);
+
+/**
+ * Draws an icon to the current render target using glyphs cached within a
+ * texture atlas. The icon is centred within the given area, and is shrunk to
+ * fit within it if required.
+ *
+ * \param ctx	Font context.
+ * \param icon	UTF-16 glyph.
+ * \param fg	Colour of icon.
+ * \param area	Area to draw the icon within.
+ * \return	0 on success, or -1 on error (check SDL_GetError()).
+ */
+int font_draw_icon(font_ctx_s *ctx, Uint16 icon, SDL_Colour fg,
+	const SDL_Rect *area);
+
+/**
+ * Sets the icons that are drawn with font_draw_icon(). They are rasterised
+ * into the icon atlas together, and again whenever the atlas is emptied by a
+ * change of font size, so that drawing them does not rasterise any glyphs.
+ * Other icons are rasterised when first drawn.
+ *
+ * \param ctx	Font context.
+ * \param icons	UTF-16 glyphs. Duplicates are ignored. A copy is taken.
+ * \param n	Number of icons.
+ */
+void font_set_icons(font_ctx_s *ctx, const Uint16 *icons, size_t n);
+
+/**
+ * Sets whether glyphs drawn by font_draw_text() and font_draw_icon() are
+ * rasterised once at a reference size and scaled to the current font size
+ * when drawn. Scaled glyphs are slightly softer, but are not rasterised again
+ * when font sizes are changed by DPI with font_change_pt(). Disabled by
+ * default.
+ *
+ * \param ctx	Font context.
+ * \param enable	Whether to draw scaled glyphs.
+ */
+void font_set_scaled_glyphs(font_ctx_s *ctx, SDL_bool enable);
+
+/**
+ * Queues the UTF-8 string str to be rendered on a background thread. The
+ * result is obtained with font_collect_render(). Requests are rendered at
+ * the font sizes at the time they were made, even if font sizes are changed
+ * with font_change_pt() before they are rendered.
+ *
+ * \param ctx	Font context.
+ * \param id	Identifier returned with the result.
+ * \param str	UTF-8 string. A copy is taken.
+ * \param s	Style of font.
+ * \param q	Quality of rendering.
+ * \param fg	Font colour.
+ * \param max_w	Width to truncate the text to. See font_render_text().
+ * \return	0 on success, or -1 if background rendering is unavailable, in
+ *		which case font_render_text() must be used instead.
+ */
+int font_render_text_async(font_ctx_s *ctx, Uint64 id, const char *str,
+	font_style_e s, font_quality_e q, SDL_Colour fg, int max_w);
+
+/**
+ * Queues an icon to be rendered on a background thread. See
+ * font_render_text_async().
+ *
+ * \return	0 on success, or -1 if background rendering is unavailable.
+ */
+int font_render_icon_async(font_ctx_s *ctx, Uint64 id, Uint16 icon,
+	SDL_Colour fg);
+
+/**
+ * Obtains a surface rendered on a background thread, if one is ready.
+ *
+ * \param ctx	Font context.
+ * \param id	Set to the identifier given when rendering was requested.
+ * \param surf	Set to the rendered surface, which must be freed with
+ *		SDL_FreeSurface(), or NULL if rendering failed.
+ * \return	1 if a result was obtained, or 0 if no results are ready.
+ */
+int font_collect_render(font_ctx_s *ctx, Uint64 *id, SDL_Surface **surf);
+
+/**
+ * Checks whether installed fonts are still being discovered. Text rendered
+ * whilst they are may lack glyphs that a discovered font would provide, so
+ * should not be saved beyond the current session.
+ *
+ * \param ctx	Font context.
+ * \return	SDL_TRUE if installed fonts are being discovered.
+ */
+SDL_bool font_discovery_pending(font_ctx_s *ctx);
 
 /**
  * Obtains font height for the selected style.
@@ -71,6 +183,38 @@ SDL_Texture *font_render_text(font_ctx_s *ctx, const char *str,
  */
 int font_get_height(font_ctx_s *ctx, font_style_e style);
 
+/**
+ * Obtains the height that a font would have at the given size, without
+ * changing font sizes. Used to choose font sizes before calling
+ * font_change_pt().
+ *
+ * \param ctx	Font context.
+ * \param style	Style of font to get height for.
+ * \param pt	Point size.
+ * \param vdpi	Vertical DPI.
+ * \return	Font height in pixels, which may differ from the height once
+ *		the size is set by a pixel.
+ */
+int font_get_height_at(font_ctx_s *ctx, font_style_e style, int pt,
+	unsigned vdpi);
+
+/**
+ * Measures the size of a UTF-8 string without rendering it. Advances and
+ * kerning are cached per style, so that measuring is cheap enough to lay out
+ * text every frame. The size is that of the surface returned by
+ * font_render_text(), except for glyphs that extend beyond their advance.
+ * Must only be called from the main thread.
+ *
+ * \param ctx	Font context.
+ * \param str	UTF-8 string.
+ * \param s	Style of font.
+ * \param w	Set to the width of the string in pixels. May be NULL.
+ * \param h	Set to the height of the string in pixels. May be NULL.
+ * \return	0 on success, or -1 on error.
+ */
+int font_measure_text(font_ctx_s *ctx, const char *str, font_style_e s,
+	int *w, int *h);
+
 /**
  * Scale font sizes depending on the DPI scale.
  * Internal font sizes are referenced to a DPI of 96.
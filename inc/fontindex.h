@@ -0,0 +1,77 @@
+/**
+ * Discovery of fonts installed on the system.
+ * Copyright (C) 2022 Mahyar Koshkouei
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ */
+
+#pragma once
+
+#include "hedley.h"
+#include "SDL.h"
+
+/**
+ * Opaque index of installed fonts.
+ */
+typedef struct font_index font_index_s;
+
+/**
+ * Records the code points that a font provides, as read from its character
+ * map. Only the first font within a font collection is read.
+ *
+ * \param rw	TrueType or OpenType font. Not closed by this function.
+ * \param map	Bitmap of map_len bytes. Bit (cp % 8) of byte (cp / 8) is set
+ *		for each code point cp that the font provides. Bits that are
+ *		already set are not cleared.
+ * \param map_len	Size of map in bytes.
+ * \return	0 on success, or -1 if the character map could not be read.
+ */
+HEDLEY_NON_NULL(1,2)
+int font_index_read_coverage(SDL_RWops *rw, Uint8 *map, size_t map_len);
+
+/**
+ * Opens the index of fonts installed on the system. The index saved at path
+ * by a previous session is used if no font directory has changed since.
+ * Otherwise, font directories are scanned on a background thread, and the
+ * index is saved to path once the scan is complete. Fonts found by a previous
+ * scan are not read again unless they have been modified.
+ *
+ * \param path	Location of the saved index. May be NULL to not save the
+ *		index.
+ * \return	Font index, or NULL if fonts cannot be discovered on this
+ *		platform.
+ */
+font_index_s *font_index_open(const char *path);
+
+/**
+ * Checks whether the index is ready to be searched.
+ *
+ * \param idx	Font index.
+ * \return	SDL_FALSE while font directories are being scanned.
+ */
+HEDLEY_NON_NULL(1)
+SDL_bool font_index_is_ready(font_index_s *idx);
+
+/**
+ * Finds an installed font that provides the given code point. Each font is
+ * returned at most once, and a code point that no remaining font provides is
+ * only searched for once, so that callers may search for every code point
+ * that their loaded fonts do not provide. This function is not thread safe.
+ *
+ * \param idx	Font index.
+ * \param cp	Code point.
+ * \return	Location of the font, which remains valid until the index is
+ *		closed, or NULL if no further font provides the code point or
+ *		if the scan has not completed.
+ */
+HEDLEY_NON_NULL(1)
+const char *font_index_find(font_index_s *idx, Uint32 cp);
+
+/**
+ * Closes the index, waiting for any scan in progress to complete.
+ *
+ * \param idx	Font index. May be NULL.
+ */
+void font_index_close(font_index_s *idx);
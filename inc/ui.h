@@ -24,6 +24,18 @@ typedef struct ui_ctx ui_ctx_s;
 
 #define UI_EVENT_MASK (SDL_WINDOWEVENT | SDL_MOUSEMOTION | SDL_KEYDOWN | SDL_JOYAXISMOTION)
 
+/* Hint read by ui_init(). If set to "1", text and icons are drawn from glyphs
+ * rasterised once and scaled to the current DPI, so that changing the window
+ * size or DPI does not rasterise them again. May also be set as an environment
+ * variable. */
+#define UI_HINT_SCALED_GLYPHS "HAIYAJAN_UI_SCALED_GLYPHS"
+
+/* Hint read by ui_init(). If set to "1", the default, text that is being
+ * rendered in the background is drawn from a quickly rendered low quality
+ * bitmap until the high quality bitmap is ready, rather than as a placeholder.
+ * May also be set as an environment variable. */
+#define UI_HINT_PROGRESSIVE_TEXT "HAIYAJAN_UI_PROGRESSIVE_TEXT"
+
 /* Forward declerations. */
 struct ui_element;
 
@@ -167,6 +179,36 @@ struct ui_element {
 	} elem;
 };
 
+/**
+ * Statistics of the texture cache, used to size the cache budget and to find
+ * whether the cache is thrashing. Counters accumulate from ui_init().
+ */
+struct ui_cache_stats {
+	/* Lookups that found a bitmap cached for the element. */
+	Uint64 hits;
+	/* Lookups that did not find a bitmap cached for the element. */
+	Uint64 misses;
+	/* Misses that were satisfied by sharing the bitmap of another element
+	 * with identical content. */
+	Uint64 shared_hits;
+	/* Misses that were satisfied by the texture pack. */
+	Uint64 pack_hits;
+	/* Entries removed because their element had changed. */
+	Uint64 stale;
+	/* Entries evicted to keep the cache within its budget. */
+	Uint64 evictions;
+
+	/* Number of cached entries, and the bitmaps they refer to. */
+	unsigned entries;
+	unsigned bitmaps;
+	/* Estimated video memory used by bitmaps, and the budget. */
+	size_t bytes;
+	size_t budget;
+	/* Number of atlas pages, and the video memory that they use. */
+	unsigned pages;
+	size_t page_bytes;
+};
+
 /**
  * Initialise user interface from an SDL Renderer.
  *
@@ -194,6 +236,16 @@ SDL_Texture *ui_render_frame(ui_ctx_s *ctx);
  */
 void ui_process_event(ui_ctx_s *HEDLEY_RESTRICT ctx, SDL_Event *HEDLEY_RESTRICT e);
 
+/**
+ * Obtains statistics of the texture cache.
+ *
+ * \param ctx	UI Context.
+ * \param stats	Set to the current statistics.
+ */
+HEDLEY_NON_NULL(1,2)
+void ui_get_cache_stats(const ui_ctx_s *HEDLEY_RESTRICT ctx,
+	struct ui_cache_stats *HEDLEY_RESTRICT stats);
+
 /**
  * Free UI context.
  *
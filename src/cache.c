@@ -21,177 +21,1620 @@
 #include "stb_arr.h"
 #include "ui.h"
 
+/**
+ * A row of allocations within an atlas page. Allocations are placed left to
+ * right, and the height of the shelf is fixed when it is opened.
+ */
+struct atlas_shelf {
+	int y, h;
+	/* Horizontal position of the next allocation. */
+	int x;
+};
+
+/**
+ * A texture holding many cached bitmaps, so that drawing a menu requires few
+ * texture changes.
+ */
+struct atlas_page {
+	SDL_Texture *tex;
+	int w, h;
+
+	struct atlas_shelf *shelves;
+	/* Vertical position of the next shelf. */
+	int shelf_bottom;
+
+	/* Number of cached bitmaps allocated within this page. */
+	unsigned live;
+
+	/* Number of entries within this page that were used since a page was
+	 * last evicted. Only valid whilst a page is being selected for
+	 * eviction. */
+	unsigned referenced;
+
+	/* Set for pages created to hold a single bitmap that is too large for
+	 * a shared page. */
+	SDL_bool dedicated;
+};
+
+/**
+ * A bitmap held by the cache within an atlas page. A bitmap may be referenced
+ * by more than one cache entry, and is only released once all references are
+ * released.
+ */
+struct cached_tex {
+	struct atlas_page *page;
+
+	/* Location of the bitmap within the page. */
+	SDL_Rect src;
+
+	/* Estimated video memory used by the bitmap, including padding. */
+	size_t bytes;
+
+	/* Number of cache entries that refer to this bitmap. */
+	unsigned refs;
+
+	/* Identifies the content and rendering parameters of the bitmap, so
+	 * that elements with identical content may share the bitmap. */
+	Uint64 content_key;
+};
+
 struct textures {
 	ui_texture_part_e part;
 	Hash label_hash;
 	const void *data_origin;
-	struct ui_element el;
+	/* Fingerprint of the element fields that affect rendering. */
+	Hash fingerprint;
+	/* Generation of font sizes that the bitmap was rendered with. */
+	Uint32 generation;
+	/* Key of the content of the bitmap, which changes with parameters
+	 * such as the width that a label is truncated to. */
+	Uint64 content_key;
+	struct cached_tex *ct;
+
+	/* Set when the texture is used, and cleared by the eviction clock. */
+	SDL_bool referenced;
+};
+
+/**
+ * A render target texture that is not currently in use, kept so that it may
+ * be reused by a request for a texture of the same format and size.
+ */
+struct pooled_target {
 	SDL_Texture *tex;
+	Uint32 format;
+	int w, h;
+};
+
+/**
+ * A cached bitmap that was read back from video memory, waiting to be encoded
+ * and written to a file by a dump worker.
+ */
+struct dump_job {
+	char filename[32];
+	Uint8 *rgba;
+	int w, h;
+};
+
+/**
+ * A cache dump in progress.
+ */
+struct dump_batch {
+	struct dump_job *jobs;
+	/* Next job to be claimed by a worker. */
+	SDL_atomic_t next;
+	/* Number of workers that have not finished. */
+	SDL_atomic_t running;
+	SDL_Thread **threads;
+};
+
+/**
+ * A rendered bitmap held in the persistent pack, encoded as a QOI image.
+ */
+struct packed_surface {
+	Uint64 key;
+	const Uint8 *qoi;
+	Uint32 len;
+
+	/* Set if qoi was allocated separately from the loaded pack file. */
+	SDL_bool owned;
+	/* Set if the bitmap was used or added during this session. */
+	SDL_bool used;
 };
 
 struct cache_ctx {
+	SDL_Renderer *rend;
+
 	struct textures *cached_ui;
+
+	/* Open-addressing index into cached_ui, using linear probing. Each
+	 * slot holds the location of an entry plus one, so that zero marks an
+	 * empty slot. The number of slots is always a power of two. */
+	Uint32 *index;
+	Uint32 index_mask;
+
+	/* Open-addressing table of cached bitmaps by content key, using linear
+	 * probing. An empty slot is NULL. The number of slots is always a
+	 * power of two. */
+	struct cached_tex **shared;
+	Uint32 shared_mask;
+	unsigned shared_count;
+
+	/* Total estimated size of all cached textures, and the size that the
+	 * cache may grow to before textures are evicted. */
+	size_t bytes;
+	size_t budget;
+
+	/* Location of the next entry to consider for eviction. */
+	unsigned clock_hand;
+
+	/* Generation of font sizes that entries are looked up and stored
+	 * with. */
+	Uint32 generation;
+
+	/* Cumulative counters. Other statistics are calculated when
+	 * requested. */
+	struct ui_cache_stats stats;
+	/* Number of bitmaps held in the atlas. */
+	unsigned bitmaps;
+
+	/* Textures that are no longer referenced by the cache, but may still
+	 * be in use by the renderer in the current frame. These are destroyed
+	 * by destroy_retired_textures(). */
+	SDL_Texture **retired;
+
+	/* Render targets available for reuse, oldest first. */
+	struct pooled_target *pool;
+
+	/* Cache dump being written by worker threads, if any. */
+	struct dump_batch *dump;
+
+	/* Atlas pages holding all cached bitmaps. */
+	struct atlas_page **pages;
+	/* Size of shared atlas pages, and the memory used by all pages. */
+	int page_w, page_h;
+	size_t page_bytes;
+	/* Pixel format of atlas pages. Bitmaps are rendered in white and are
+	 * tinted when drawn, so only their alpha must be kept. */
+	Uint32 page_format;
+
+	/* Persistent pack of rendered bitmaps, sorted by key. */
+	struct packed_surface *pack;
+	/* Contents of the pack file that was loaded, if any. */
+	void *pack_file;
+	/* Location that the pack is saved to. */
+	char *pack_path;
+	SDL_bool pack_dirty;
 };
 
-static const char *part_str[] = {
-	"label", "icon"
-};
+/* Identifies a texture pack file. The version must be incremented whenever
+ * the format changes, or whenever the rendering of bitmaps changes. */
+#define CACHE_PACK_MAGIC	SDL_FOURCC('H', 'Y', 'P', 'K')
+#define CACHE_PACK_VERSION	1
+#define CACHE_PACK_HEADER_SZ	16
+#define CACHE_PACK_RECORD_SZ	16
+
+/* Maximum size of the bitmaps saved to the pack. Bitmaps used during the
+ * session are always saved first. */
+#define CACHE_PACK_MAX_BYTES (4 * 1024 * 1024)
+
+/* Preferred size of shared atlas pages. Smaller pages are used if the
+ * renderer does not support textures of this size. */
+#define CACHE_ATLAS_PAGE_SIZE 1024
+
+/* Transparent border around each bitmap in an atlas page, so that filtering
+ * a scaled bitmap does not sample its neighbours. */
+#define CACHE_ATLAS_PADDING 1
+
+/* Maximum number of threads used to encode and write a cache dump. */
+#define CACHE_DUMP_MAX_THREADS 4
+
+/* Maximum number of render targets held in the pool. */
+#define CACHE_TARGET_POOL_MAX 4
+
+/* Initial number of slots in the index. Must be a power of two. */
+#define CACHE_INDEX_MIN_SLOTS 64
+
+static const char *part_str[] = {
+	"label", "icon"
+};
+
+/**
+ * Calculates a fingerprint of the fields of an element that affect how its
+ * label and icon are rendered. The label itself is not included, as it is
+ * compared using the label hash.
+ */
+static Hash element_fingerprint(const struct ui_element *el)
+{
+	struct {
+		Uint32 type;
+		Uint32 style;
+		Uint32 label_placement;
+		Uint16 icon;
+		Uint8 fg[4];
+	} f;
+
+	/* Zeroed so that padding and unused fields do not affect the
+	 * fingerprint. */
+	SDL_zero(f);
+	f.type = el->type;
+
+	switch(el->type)
+	{
+	case UI_ELEM_TYPE_LABEL:
+		f.style = el->elem.label.style;
+		break;
+
+	case UI_ELEM_TYPE_TILE:
+		f.label_placement = el->elem.tile.label_placement;
+		f.icon = el->elem.tile.icon;
+		f.fg[0] = el->elem.tile.fg.r;
+		f.fg[1] = el->elem.tile.fg.g;
+		f.fg[2] = el->elem.tile.fg.b;
+		f.fg[3] = el->elem.tile.fg.a;
+		break;
+
+	default:
+		break;
+	}
+
+	return HASH_FN(&f, sizeof(f), 0);
+}
+
+static Uint32 cache_index_slot(const cache_ctx_s *ctx,
+	const void *data_origin, ui_texture_part_e part, Uint32 generation)
+{
+	Hash h = HASH_FN(&data_origin, sizeof(data_origin),
+		((Uint64)generation << 8) | part);
+	return (Uint32)h & ctx->index_mask;
+}
+
+/**
+ * Finds the index slot that refers to the entry for the given element part.
+ * Only a single entry is held for each part of an element within a
+ * generation, so the label hash is not required to locate it.
+ *
+ * \return Slot number, or the empty slot where the entry would be inserted.
+ */
+static Uint32 cache_index_find(const cache_ctx_s *ctx,
+	const void *data_origin, ui_texture_part_e part, Uint32 generation)
+{
+	Uint32 slot = cache_index_slot(ctx, data_origin, part, generation);
+
+	while(ctx->index[slot] != 0)
+	{
+		const struct textures *t = &ctx->cached_ui[ctx->index[slot] - 1];
+
+		if(t->data_origin == data_origin && t->part == part &&
+			t->generation == generation)
+			break;
+
+		slot = (slot + 1) & ctx->index_mask;
+	}
+
+	return slot;
+}
+
+/**
+ * Rebuilds the index with the given number of slots.
+ *
+ * \param slots	Number of slots. Must be a power of two.
+ * \return	0 on success, or -1 if out of memory.
+ */
+static int cache_index_rebuild(cache_ctx_s *ctx, Uint32 slots)
+{
+	Uint32 *new_index;
+	unsigned count;
+
+	new_index = SDL_calloc(slots, sizeof(*new_index));
+	if(new_index == NULL)
+		return -1;
+
+	SDL_free(ctx->index);
+	ctx->index = new_index;
+	ctx->index_mask = slots - 1;
+
+	count = stb_arr_len(ctx->cached_ui);
+	for(unsigned i = 0; i < count; i++)
+	{
+		const struct textures *t = &ctx->cached_ui[i];
+		Uint32 slot = cache_index_find(ctx, t->data_origin, t->part,
+			t->generation);
+		ctx->index[slot] = i + 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Removes a slot from the index. Entries that follow in the same probe
+ * sequence are shifted back, so that tombstones are never required.
+ */
+static void cache_index_remove(cache_ctx_s *ctx, Uint32 slot)
+{
+	Uint32 next = slot;
+
+	for(;;)
+	{
+		const struct textures *t;
+		Uint32 home;
+
+		ctx->index[slot] = 0;
+
+		do {
+			next = (next + 1) & ctx->index_mask;
+			if(ctx->index[next] == 0)
+				return;
+
+			t = &ctx->cached_ui[ctx->index[next] - 1];
+			home = cache_index_slot(ctx, t->data_origin, t->part,
+				t->generation);
+			/* Leave the entry in place if its home slot lies
+			 * cyclically within (slot, next]. */
+		} while(((next - home) & ctx->index_mask) <
+			((next - slot) & ctx->index_mask));
+
+		ctx->index[slot] = ctx->index[next];
+		slot = next;
+	}
+}
+
+/**
+ * Finds the slot of the shared table that holds the bitmap with the given
+ * content key.
+ *
+ * \return Slot number, or the empty slot where the bitmap would be inserted.
+ */
+static Uint32 shared_find(const cache_ctx_s *ctx, Uint64 content_key)
+{
+	Uint32 slot = (Uint32)content_key & ctx->shared_mask;
+
+	while(ctx->shared[slot] != NULL &&
+		ctx->shared[slot]->content_key != content_key)
+	{
+		slot = (slot + 1) & ctx->shared_mask;
+	}
+
+	return slot;
+}
+
+/**
+ * Makes a cached bitmap available to other elements with identical content.
+ * The bitmap is not shared if another bitmap with the same content key is
+ * already shared, or if out of memory.
+ */
+static void shared_insert(cache_ctx_s *ctx, struct cached_tex *ct)
+{
+	Uint32 slot;
+
+	/* Keep the table at most half full. */
+	if(ctx->shared == NULL || ctx->shared_count >= ctx->shared_mask / 2)
+	{
+		Uint32 slots = ctx->shared == NULL ?
+			CACHE_INDEX_MIN_SLOTS : (ctx->shared_mask + 1) * 2;
+		struct cached_tex **old = ctx->shared;
+		Uint32 old_slots = ctx->shared == NULL ?
+			0 : ctx->shared_mask + 1;
+		struct cached_tex **new_shared;
+
+		new_shared = SDL_calloc(slots, sizeof(*new_shared));
+		if(new_shared == NULL)
+			return;
+
+		ctx->shared = new_shared;
+		ctx->shared_mask = slots - 1;
+
+		for(Uint32 i = 0; i < old_slots; i++)
+		{
+			if(old[i] == NULL)
+				continue;
+
+			ctx->shared[shared_find(ctx, old[i]->content_key)] =
+				old[i];
+		}
+
+		SDL_free(old);
+	}
+
+	slot = shared_find(ctx, ct->content_key);
+	if(ctx->shared[slot] != NULL)
+		return;
+
+	ctx->shared[slot] = ct;
+	ctx->shared_count++;
+}
+
+/**
+ * Removes a bitmap from the shared table, if it is held there. Bitmaps that
+ * follow in the same probe sequence are shifted back.
+ */
+static void shared_remove(cache_ctx_s *ctx, const struct cached_tex *ct)
+{
+	Uint32 slot, next;
+
+	if(ctx->shared == NULL)
+		return;
+
+	slot = shared_find(ctx, ct->content_key);
+	if(ctx->shared[slot] != ct)
+		return;
+
+	ctx->shared_count--;
+	next = slot;
+
+	for(;;)
+	{
+		Uint32 home;
+
+		ctx->shared[slot] = NULL;
+
+		do {
+			next = (next + 1) & ctx->shared_mask;
+			if(ctx->shared[next] == NULL)
+				return;
+
+			home = (Uint32)ctx->shared[next]->content_key &
+				ctx->shared_mask;
+		} while(((next - home) & ctx->shared_mask) <
+			((next - slot) & ctx->shared_mask));
+
+		ctx->shared[slot] = ctx->shared[next];
+		slot = next;
+	}
+}
+
+static void evict_atlas_pages(cache_ctx_s *ctx, size_t bytes);
+static SDL_bool evict_atlas_page(cache_ctx_s *ctx);
+static void dump_finish(cache_ctx_s *ctx, SDL_bool wait);
+
+static void atlas_remove_page(cache_ctx_s *ctx, struct atlas_page *page)
+{
+	unsigned count = stb_arr_len(ctx->pages);
+
+	for(unsigned i = 0; i < count; i++)
+	{
+		if(ctx->pages[i] != page)
+			continue;
+
+		stb_arr_fastdelete(ctx->pages, i);
+		break;
+	}
+
+	ctx->page_bytes -= (size_t)page->w * (size_t)page->h *
+		SDL_BYTESPERPIXEL(ctx->page_format);
+	stb_arr_push(ctx->retired, page->tex);
+	stb_arr_free(page->shelves);
+	SDL_free(page);
+}
+
+static struct atlas_page *atlas_new_page(cache_ctx_s *ctx, int w, int h,
+	SDL_bool dedicated)
+{
+	struct atlas_page *page;
+
+	page = SDL_calloc(1, sizeof(*page));
+	if(page == NULL)
+		return NULL;
+
+	page->tex = SDL_CreateTexture(ctx->rend, ctx->page_format,
+		SDL_TEXTUREACCESS_STATIC, w, h);
+	if(page->tex == NULL)
+	{
+		SDL_free(page);
+		return NULL;
+	}
+
+	SDL_SetTextureBlendMode(page->tex, SDL_BLENDMODE_BLEND);
+	page->w = w;
+	page->h = h;
+	page->dedicated = dedicated;
+
+	stb_arr_push(ctx->pages, page);
+	ctx->page_bytes += (size_t)w * (size_t)h *
+		SDL_BYTESPERPIXEL(ctx->page_format);
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Created %dx%d atlas page", w, h);
+	return page;
+}
+
+/**
+ * Allocates space within a shared page using shelf packing. A bitmap is
+ * placed on the open shelf that wastes the least height, or on a new shelf if
+ * no open shelf fits.
+ *
+ * \return	SDL_TRUE if space was allocated.
+ */
+static SDL_bool atlas_page_alloc(struct atlas_page *page, int w, int h,
+	SDL_Rect *r)
+{
+	unsigned count = stb_arr_len(page->shelves);
+	struct atlas_shelf *best = NULL;
+
+	for(unsigned i = 0; i < count; i++)
+	{
+		struct atlas_shelf *sh = &page->shelves[i];
+
+		if(sh->h < h || sh->x + w > page->w)
+			continue;
+
+		/* Do not waste more than half of a shelf on a short bitmap. */
+		if(sh->h > h * 2)
+			continue;
+
+		if(best == NULL || sh->h < best->h)
+			best = sh;
+	}
+
+	if(best == NULL)
+	{
+		struct atlas_shelf sh;
+
+		if(page->shelf_bottom + h > page->h || w > page->w)
+			return SDL_FALSE;
+
+		sh.y = page->shelf_bottom;
+		sh.h = h;
+		sh.x = 0;
+		page->shelf_bottom += h;
+		stb_arr_push(page->shelves, sh);
+		best = &stb_arr_last(page->shelves);
+	}
+
+	r->x = best->x;
+	r->y = best->y;
+	r->w = w;
+	r->h = h;
+	best->x += w;
+	return SDL_TRUE;
+}
+
+/**
+ * Allocates space for a bitmap of the given size, including padding, within
+ * any page. A new page is created if required.
+ */
+static struct atlas_page *atlas_alloc(cache_ctx_s *ctx, int w, int h,
+	SDL_Rect *r)
+{
+	const size_t page_sz = (size_t)ctx->page_w * (size_t)ctx->page_h *
+		SDL_BYTESPERPIXEL(ctx->page_format);
+	struct atlas_page *page;
+
+	if(w > ctx->page_w || h > ctx->page_h)
+	{
+		/* Dedicated pages count against the budget as shared pages
+		 * do. */
+		evict_atlas_pages(ctx, (size_t)w * (size_t)h *
+			SDL_BYTESPERPIXEL(ctx->page_format));
+		page = atlas_new_page(ctx, w, h, SDL_TRUE);
+		if(page != NULL)
+			atlas_page_alloc(page, w, h, r);
+
+		return page;
+	}
+
+	for(;;)
+	{
+		unsigned count = stb_arr_len(ctx->pages);
+
+		for(unsigned i = 0; i < count; i++)
+		{
+			page = ctx->pages[i];
+			if(page->dedicated == SDL_FALSE &&
+				atlas_page_alloc(page, w, h, r) == SDL_TRUE)
+				return page;
+		}
+
+		/* Rather than creating a page beyond the budget, the least
+		 * used page is emptied so that its space may be reused. */
+		if(ctx->page_bytes + page_sz <= ctx->budget ||
+			evict_atlas_page(ctx) == SDL_FALSE)
+			break;
+	}
+
+	page = atlas_new_page(ctx, ctx->page_w, ctx->page_h, SDL_FALSE);
+	if(page != NULL)
+		atlas_page_alloc(page, w, h, r);
+
+	return page;
+}
+
+/**
+ * Releases a reference to a cached bitmap. When no references remain, its
+ * space in the atlas is released. A page with no remaining bitmaps is reset
+ * for reuse, unless another empty page is already available, in which case
+ * the page is retired.
+ */
+static void release_cached_tex(cache_ctx_s *ctx, struct cached_tex *ct)
+{
+	struct atlas_page *page = ct->page;
+	unsigned count;
+
+	SDL_assert(ct->refs > 0);
+
+	ct->refs--;
+	if(ct->refs > 0)
+		return;
+
+	ctx->bytes -= ct->bytes;
+	ctx->bitmaps--;
+	shared_remove(ctx, ct);
+	SDL_free(ct);
+
+	SDL_assert(page->live > 0);
+	page->live--;
+	if(page->live > 0)
+		return;
+
+	if(page->dedicated == SDL_TRUE)
+	{
+		atlas_remove_page(ctx, page);
+		return;
+	}
+
+	count = stb_arr_len(ctx->pages);
+	for(unsigned i = 0; i < count; i++)
+	{
+		const struct atlas_page *p = ctx->pages[i];
+
+		if(p != page && p->dedicated == SDL_FALSE && p->live == 0)
+		{
+			atlas_remove_page(ctx, page);
+			return;
+		}
+	}
+
+	/* Previously drawn bitmaps may be overwritten; SDL flushes any pending
+	 * draws that use the page before it is updated. */
+	stb_arr_setlen(page->shelves, 0);
+	page->shelf_bottom = 0;
+}
+
+/**
+ * Copies a surface into the atlas.
+ *
+ * \return	Cached bitmap with one reference, or NULL on error.
+ */
+static struct cached_tex *atlas_upload(cache_ctx_s *ctx, SDL_Surface *surf,
+	Uint64 content_key)
+{
+	const int pad = CACHE_ATLAS_PADDING;
+	const int bpp = SDL_BYTESPERPIXEL(ctx->page_format);
+	SDL_Surface *conv = NULL;
+	struct cached_tex *ct;
+	SDL_Rect r;
+	Uint8 *buf;
+	int pitch;
+
+	if(surf->format->format != ctx->page_format)
+	{
+		conv = SDL_ConvertSurfaceFormat(surf, ctx->page_format, 0);
+		if(conv == NULL)
+			return NULL;
+
+		surf = conv;
+	}
+
+	ct = SDL_malloc(sizeof(*ct));
+	if(ct == NULL)
+		goto err;
+
+	ct->page = atlas_alloc(ctx, surf->w + pad * 2, surf->h + pad * 2, &r);
+	if(ct->page == NULL)
+		goto err;
+
+	/* Upload the bitmap along with its transparent border. */
+	pitch = r.w * bpp;
+	buf = SDL_calloc(r.h, pitch);
+	if(buf == NULL)
+	{
+		/* The allocated space is left unused until the page is
+		 * reset. */
+		goto err;
+	}
+
+	SDL_LockSurface(surf);
+	for(int y = 0; y < surf->h; y++)
+	{
+		SDL_memcpy(buf + (y + pad) * pitch + pad * bpp,
+			(const Uint8 *)surf->pixels + y * surf->pitch,
+			(size_t)surf->w * bpp);
+	}
+	SDL_UnlockSurface(surf);
+
+	SDL_UpdateTexture(ct->page->tex, &r, buf, pitch);
+	SDL_free(buf);
+
+	ct->src.x = r.x + pad;
+	ct->src.y = r.y + pad;
+	ct->src.w = surf->w;
+	ct->src.h = surf->h;
+	ct->bytes = (size_t)r.w * (size_t)r.h * bpp;
+	ct->refs = 1;
+	ct->content_key = content_key;
+	ct->page->live++;
+	ctx->bytes += ct->bytes;
+	ctx->bitmaps++;
+
+	SDL_FreeSurface(conv);
+	return ct;
+
+err:
+	SDL_free(ct);
+	SDL_FreeSurface(conv);
+	return NULL;
+}
+
+HEDLEY_NON_NULL(1,2)
+SDL_Texture *acquire_target_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
+	SDL_Renderer *HEDLEY_RESTRICT rend, Uint32 format, int w, int h)
+{
+	unsigned count = stb_arr_len(ctx->pool);
+	SDL_Texture *tex;
+
+	/* Prefer the most recently recycled texture. */
+	for(unsigned i = count; i > 0; i--)
+	{
+		struct pooled_target *pt = &ctx->pool[i - 1];
+
+		if(pt->format != format || pt->w != w || pt->h != h)
+			continue;
+
+		tex = pt->tex;
+		stb_arr_delete(ctx->pool, i - 1);
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Reusing %dx%d render target from pool", w, h);
+		return tex;
+	}
+
+	return SDL_CreateTexture(rend, format, SDL_TEXTUREACCESS_TARGET, w, h);
+}
+
+void recycle_target_texture(cache_ctx_s *ctx, SDL_Texture *tex)
+{
+	struct pooled_target pt;
+
+	SDL_assert_paranoid(ctx != NULL);
+
+	if(tex == NULL)
+		return;
+
+	if(SDL_QueryTexture(tex, &pt.format, NULL, &pt.w, &pt.h) != 0)
+	{
+		SDL_DestroyTexture(tex);
+		return;
+	}
+
+	/* Retire the least recently recycled texture if the pool is full. */
+	if(stb_arr_len(ctx->pool) >= CACHE_TARGET_POOL_MAX)
+	{
+		stb_arr_push(ctx->retired, ctx->pool[0].tex);
+		stb_arr_delete(ctx->pool, 0);
+	}
+
+	pt.tex = tex;
+	stb_arr_push(ctx->pool, pt);
+}
+
+void destroy_retired_textures(cache_ctx_s *ctx)
+{
+	unsigned count = stb_arr_len(ctx->retired);
+
+	/* Also release a cache dump once its workers have finished. */
+	dump_finish(ctx, SDL_FALSE);
+
+	if(count == 0)
+		return;
+
+	for(unsigned i = 0; i < count; i++)
+		SDL_DestroyTexture(ctx->retired[i]);
+
+	stb_arr_setlen(ctx->retired, 0);
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Destroyed %u retired textures", count);
+}
+
+/**
+ * Reads the contents of an atlas page back from video memory.
+ *
+ * \return	Pixels of the page in RGBA32 format, or NULL on error. Must be
+ *		freed with SDL_free().
+ */
+static Uint8 *atlas_read_page(cache_ctx_s *HEDLEY_RESTRICT ctx,
+	SDL_Renderer *HEDLEY_RESTRICT rend, struct atlas_page *page)
+{
+	SDL_Texture *prev_target = SDL_GetRenderTarget(rend);
+	SDL_Texture *target;
+	Uint8 *pixels = NULL;
+	const int pitch = page->w * 4;
+	Uint8 mod_r, mod_g, mod_b, mod_a;
+	int ret;
+
+	target = acquire_target_texture(ctx, rend, SDL_PIXELFORMAT_ARGB8888,
+		page->w, page->h);
+	if(target == NULL)
+		return NULL;
+
+	if(SDL_SetRenderTarget(rend, target) != 0)
+		goto out;
+
+	/* Copy the page without blending or the tint of the last tile drawn
+	 * from it, so that each bitmap is read back unchanged. */
+	SDL_GetTextureColorMod(page->tex, &mod_r, &mod_g, &mod_b);
+	SDL_GetTextureAlphaMod(page->tex, &mod_a);
+	SDL_SetTextureColorMod(page->tex, 0xFF, 0xFF, 0xFF);
+	SDL_SetTextureAlphaMod(page->tex, 0xFF);
+	SDL_SetTextureBlendMode(page->tex, SDL_BLENDMODE_NONE);
+	ret = SDL_RenderCopy(rend, page->tex, NULL, NULL);
+	SDL_SetTextureBlendMode(page->tex, SDL_BLENDMODE_BLEND);
+	SDL_SetTextureColorMod(page->tex, mod_r, mod_g, mod_b);
+	SDL_SetTextureAlphaMod(page->tex, mod_a);
+	if(ret != 0)
+		goto out;
+
+	pixels = SDL_malloc((size_t)pitch * (size_t)page->h);
+	if(pixels == NULL)
+		goto out;
+
+	if(SDL_RenderReadPixels(rend, NULL, SDL_PIXELFORMAT_RGBA32, pixels,
+		pitch) != 0)
+	{
+		SDL_free(pixels);
+		pixels = NULL;
+	}
+
+out:
+	SDL_SetRenderTarget(rend, prev_target);
+	recycle_target_texture(ctx, target);
+	return pixels;
+}
+
+/**
+ * Encodes and writes bitmaps of a cache dump. Any number of workers may
+ * process the same batch.
+ */
+static int dump_worker(void *data)
+{
+	struct dump_batch *b = data;
+	const int count = stb_arr_len(b->jobs);
+
+	for(;;)
+	{
+		const int i = SDL_AtomicAdd(&b->next, 1);
+		const struct dump_job *job;
+		SDL_RWops *rw;
+		qoi_desc qd;
+		void *qoi_img;
+		int out_len;
+
+		if(i >= count)
+			break;
+
+		job = &b->jobs[i];
+		qd.width = job->w;
+		qd.height = job->h;
+		qd.channels = 4;
+		qd.colorspace = QOI_LINEAR;
+		qoi_img = qoi_encode(job->rgba, &qd, &out_len);
+		if(qoi_img == NULL)
+			continue;
+
+		rw = SDL_RWFromFile(job->filename, "wb");
+		if(rw != NULL)
+		{
+			SDL_RWwrite(rw, qoi_img, 1, out_len);
+			SDL_RWclose(rw);
+		}
+		else
+		{
+			SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_CACHE,
+				"Unable to write '%s' for cache dump: %s",
+				job->filename, SDL_GetError());
+		}
+
+		SDL_free(qoi_img);
+	}
+
+	SDL_AtomicAdd(&b->running, -1);
+	return 0;
+}
+
+/**
+ * Frees the current cache dump once all of its workers have finished.
+ *
+ * \param wait	Whether to wait for workers that are still running.
+ */
+static void dump_finish(cache_ctx_s *ctx, SDL_bool wait)
+{
+	struct dump_batch *b = ctx->dump;
+
+	if(b == NULL)
+		return;
+
+	if(wait == SDL_FALSE && SDL_AtomicGet(&b->running) > 0)
+		return;
+
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(b->threads); i++)
+		SDL_WaitThread(b->threads[i], NULL);
+
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(b->jobs); i++)
+		SDL_free(b->jobs[i].rgba);
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Cache dump of %d bitmaps complete", stb_arr_len(b->jobs));
+
+	stb_arr_free(b->threads);
+	stb_arr_free(b->jobs);
+	SDL_free(b);
+	ctx->dump = NULL;
+}
+
+void dump_cache(cache_ctx_s *ctx, SDL_Renderer *rend)
+{
+	struct dump_batch *b;
+	unsigned count = stb_arr_len(ctx->cached_ui);
+	unsigned pages = stb_arr_len(ctx->pages);
+	int workers;
+
+	dump_finish(ctx, SDL_FALSE);
+	if(ctx->dump != NULL)
+	{
+		SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Previous cache dump is still in progress");
+		return;
+	}
+
+	b = SDL_calloc(1, sizeof(*b));
+	if(b == NULL)
+		return;
+
+	/* Each page is read back once, and the bitmaps within it are copied
+	 * out for the workers. */
+	for(unsigned p = 0; p < pages; p++)
+	{
+		const struct atlas_page *page = ctx->pages[p];
+		/* Bitmaps shared by several entries are only dumped once. */
+		const struct cached_tex **dumped = NULL;
+		Uint8 *pixels;
+
+		if(page->live == 0)
+			continue;
+
+		pixels = atlas_read_page(ctx, rend, ctx->pages[p]);
+		if(pixels == NULL)
+		{
+			char errstr[128];
+			SDL_GetErrorMsg(errstr, sizeof(errstr));
+			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+				     "Unable to read atlas page for "
+				     "cache dump: %s",
+				     errstr);
+			continue;
+		}
+
+		for(unsigned i = 0; i < count; i++)
+		{
+			const struct textures *t = &ctx->cached_ui[i];
+			const SDL_Rect *src = &t->ct->src;
+			struct dump_job job;
+			SDL_bool seen = SDL_FALSE;
+
+			if(t->ct->page != page)
+				continue;
+
+			for(unsigned d = 0; d < (unsigned)stb_arr_len(dumped);
+				d++)
+			{
+				if(dumped[d] == t->ct)
+				{
+					seen = SDL_TRUE;
+					break;
+				}
+			}
+
+			if(seen == SDL_TRUE)
+				continue;
+
+			job.w = src->w;
+			job.h = src->h;
+			job.rgba = SDL_malloc((size_t)src->w * src->h * 4);
+			if(job.rgba == NULL)
+				continue;
+
+			for(int y = 0; y < src->h; y++)
+			{
+				SDL_memcpy(job.rgba + (size_t)y * src->w * 4,
+					pixels + ((size_t)(src->y + y) *
+						page->w + src->x) * 4,
+					(size_t)src->w * 4);
+			}
+
+			/* Label hashes are not unique, so bitmaps are named
+			 * by their content. */
+			SDL_snprintf(job.filename, sizeof(job.filename),
+				"%s_%016" SDL_PRIX64 ".qoi", part_str[t->part],
+				t->ct->content_key);
+			stb_arr_push(b->jobs, job);
+			stb_arr_push(dumped, t->ct);
+		}
+
+		stb_arr_free(dumped);
+		SDL_free(pixels);
+	}
+
+	ctx->dump = b;
+
+	/* Leave a core for the render thread. */
+	workers = SDL_GetCPUCount() - 1;
+	workers = SDL_max(workers, 1);
+	workers = SDL_min(workers, CACHE_DUMP_MAX_THREADS);
+	workers = SDL_min(workers, stb_arr_len(b->jobs));
+	SDL_AtomicSet(&b->running, workers);
+
+	for(int i = 0; i < workers; i++)
+	{
+		SDL_Thread *th;
+
+		th = SDL_CreateThread(dump_worker, "cache_dump", b);
+		if(th == NULL)
+		{
+			SDL_AtomicAdd(&b->running, -1);
+			continue;
+		}
+
+		stb_arr_push(b->threads, th);
+	}
+
+	/* Encode on this thread if threads are unavailable. */
+	if(workers > 0 && stb_arr_len(b->threads) == 0)
+	{
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Unable to create cache dump threads: %s",
+			SDL_GetError());
+		SDL_AtomicSet(&b->running, 1);
+		dump_worker(b);
+	}
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Started cache dump of %d bitmaps from %u pages using %d "
+		"threads", stb_arr_len(b->jobs), pages,
+		stb_arr_len(b->threads));
+}
+
+/**
+ * Finds a bitmap in the pack.
+ *
+ * \return Location of the bitmap, or the location that the bitmap should be
+ *	inserted at if it is not found.
+ */
+static unsigned pack_find(const cache_ctx_s *ctx, Uint64 key,
+	SDL_bool *found)
+{
+	unsigned lo = 0, hi = stb_arr_len(ctx->pack);
+
+	while(lo < hi)
+	{
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if(ctx->pack[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*found = (lo < (unsigned)stb_arr_len(ctx->pack) &&
+		ctx->pack[lo].key == key) ? SDL_TRUE : SDL_FALSE;
+	return lo;
+}
+
+static int pack_cmp(const void *a, const void *b)
+{
+	const struct packed_surface *pa = a, *pb = b;
+
+	if(pa->key < pb->key)
+		return -1;
+
+	return pa->key > pb->key;
+}
+
+static Uint32 read_le32(const Uint8 *p)
+{
+	return (Uint32)p[0] | ((Uint32)p[1] << 8) |
+		((Uint32)p[2] << 16) | ((Uint32)p[3] << 24);
+}
+
+void load_texture_pack(cache_ctx_s *ctx, const char *path)
+{
+	Uint8 *file;
+	size_t file_sz, data_off;
+	Uint32 count;
+
+	SDL_assert_paranoid(ctx->pack == NULL);
+
+	ctx->pack_path = SDL_strdup(path);
+	file = SDL_LoadFile(path, &file_sz);
+	if(file == NULL)
+	{
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"No texture pack loaded from '%s': %s",
+			path, SDL_GetError());
+		return;
+	}
+
+	if(file_sz < CACHE_PACK_HEADER_SZ ||
+		read_le32(file) != CACHE_PACK_MAGIC ||
+		read_le32(file + 4) != CACHE_PACK_VERSION)
+	{
+		SDL_LogInfo(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Ignoring incompatible texture pack '%s'", path);
+		goto err;
+	}
+
+	count = read_le32(file + 8);
+	data_off = CACHE_PACK_HEADER_SZ + (size_t)count * CACHE_PACK_RECORD_SZ;
+	if(data_off > file_sz)
+		goto corrupt;
+
+	for(Uint32 i = 0; i < count; i++)
+	{
+		const Uint8 *rec = file + CACHE_PACK_HEADER_SZ +
+			(size_t)i * CACHE_PACK_RECORD_SZ;
+		struct packed_surface ps;
+		Uint32 off;
+
+		ps.key = (Uint64)read_le32(rec) |
+			((Uint64)read_le32(rec + 4) << 32);
+		off = read_le32(rec + 8);
+		ps.len = read_le32(rec + 12);
+		if(off > file_sz - data_off || ps.len > file_sz - data_off - off)
+			goto corrupt;
+
+		ps.qoi = file + data_off + off;
+		ps.owned = SDL_FALSE;
+		ps.used = SDL_FALSE;
+		stb_arr_push(ctx->pack, ps);
+	}
+
+	SDL_qsort(ctx->pack, stb_arr_len(ctx->pack), sizeof(*ctx->pack),
+		pack_cmp);
+	ctx->pack_file = file;
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Loaded %u bitmaps from texture pack '%s'",
+		(unsigned)count, path);
+	return;
 
-static SDL_Surface *tex_to_surf(SDL_Renderer *rend, SDL_Texture *tex)
+corrupt:
+	SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Texture pack '%s' is corrupt", path);
+err:
+	stb_arr_free(ctx->pack);
+	ctx->pack = NULL;
+	SDL_free(file);
+}
+
+HEDLEY_NON_NULL(1)
+SDL_Surface *get_packed_surface(cache_ctx_s *ctx, Uint64 key)
 {
-	SDL_Surface *surf = NULL;
-	SDL_Texture *core_tex;
-	SDL_Rect rect = { 0 };
-	int fmt = SDL_PIXELFORMAT_ARGB8888;
+	SDL_Surface *surf;
+	struct packed_surface *ps;
+	qoi_desc qd;
+	void *pixels;
+	SDL_bool found;
+	unsigned loc;
 
-	SDL_QueryTexture(tex, NULL, NULL, &rect.w, &rect.h);
-	core_tex = SDL_CreateTexture(rend, fmt, SDL_TEXTUREACCESS_TARGET,
-				     rect.w, rect.h);
-	if(core_tex == NULL)
+	loc = pack_find(ctx, key, &found);
+	if(found == SDL_FALSE)
 		return NULL;
 
-	if(SDL_SetRenderTarget(rend, core_tex) != 0)
-		goto err;
+	ps = &ctx->pack[loc];
+	pixels = qoi_decode(ps->qoi, (int)ps->len, &qd, 4);
+	if(pixels == NULL)
+		return NULL;
 
-	SDL_SetRenderDrawColor(rend, 0, 0, 0, SDL_ALPHA_TRANSPARENT);
-	SDL_RenderClear(rend);
+	/* The decoded pixels are RGBA in byte order. */
+	surf = SDL_CreateRGBSurfaceWithFormat(0, qd.width, qd.height, 32,
+		SDL_PIXELFORMAT_RGBA32);
+	if(surf != NULL)
+	{
+		SDL_LockSurface(surf);
+		for(unsigned y = 0; y < qd.height; y++)
+		{
+			SDL_memcpy((Uint8 *)surf->pixels + y * surf->pitch,
+				(const Uint8 *)pixels + y * qd.width * 4,
+				qd.width * 4);
+		}
+		SDL_UnlockSurface(surf);
+		ps->used = SDL_TRUE;
+		ctx->stats.pack_hits++;
+	}
 
-	if(SDL_RenderCopy(rend, tex, NULL, &rect) != 0)
-		goto err;
+	SDL_free(pixels);
+	return surf;
+}
 
-	surf = SDL_CreateRGBSurfaceWithFormat(0, rect.w, rect.h,
-					      SDL_BITSPERPIXEL(fmt), fmt);
-	if(surf == NULL)
-		goto err;
+HEDLEY_NON_NULL(1,3)
+void store_packed_surface(cache_ctx_s *HEDLEY_RESTRICT ctx, Uint64 key,
+	SDL_Surface *HEDLEY_RESTRICT surf)
+{
+	struct packed_surface ps;
+	SDL_Surface *conv;
+	qoi_desc qd;
+	SDL_bool found;
+	unsigned loc;
+	int len;
+
+	loc = pack_find(ctx, key, &found);
+	if(found == SDL_TRUE)
+		return;
 
-	if(SDL_RenderReadPixels(rend, &rect, fmt, surf->pixels, surf->pitch) != 0)
+	conv = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_RGBA32, 0);
+	if(conv == NULL)
+		return;
+
+	SDL_LockSurface(conv);
+	qd.width = conv->w;
+	qd.height = conv->h;
+	qd.channels = 4;
+	qd.colorspace = QOI_SRGB;
+	if(conv->pitch == conv->w * 4)
 	{
-		SDL_FreeSurface(surf);
-		goto err;
+		ps.qoi = qoi_encode(conv->pixels, &qd, &len);
+	}
+	else
+	{
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Unable to pack surface with padded pitch");
+		ps.qoi = NULL;
 	}
+	SDL_UnlockSurface(conv);
+	SDL_FreeSurface(conv);
 
-err:
-	SDL_SetRenderTarget(rend, NULL);
-	SDL_DestroyTexture(core_tex);
-	return surf;
+	if(ps.qoi == NULL)
+		return;
+
+	ps.key = key;
+	ps.len = (Uint32)len;
+	ps.owned = SDL_TRUE;
+	ps.used = SDL_TRUE;
+	stb_arr_insert(ctx->pack, loc, ps);
+	ctx->pack_dirty = SDL_TRUE;
 }
 
-void dump_cache(cache_ctx_s *ctx, SDL_Renderer *rend)
+static void write_le32(Uint8 *p, Uint32 v)
 {
-	unsigned count;
-	count = stb_arr_len(ctx->cached_ui);
+	p[0] = (Uint8)v;
+	p[1] = (Uint8)(v >> 8);
+	p[2] = (Uint8)(v >> 16);
+	p[3] = (Uint8)(v >> 24);
+}
 
-	for(unsigned i = 0; i < count; i++)
-	{
-		struct textures *t;
-		SDL_Surface *s;
-		int out_len;
-		qoi_desc qd;
-		void *qoi_img;
+void save_texture_pack(cache_ctx_s *ctx)
+{
+	unsigned count = stb_arr_len(ctx->pack);
+	struct packed_surface **save = NULL;
+	Uint32 data_len = 0;
+	Uint8 hdr[CACHE_PACK_HEADER_SZ];
+	SDL_RWops *rw;
+
+	if(ctx->pack_path == NULL || ctx->pack_dirty == SDL_FALSE)
+		return;
 
-		t = &ctx->cached_ui[i];
-		s = tex_to_surf(rend, t->tex);
-		if(s == NULL)
+	/* Bitmaps used in this session are saved first, followed by bitmaps
+	 * carried over from previous sessions while space remains. */
+	for(int pass = 0; pass < 2; pass++)
+	{
+		for(unsigned i = 0; i < count; i++)
 		{
-			char errstr[128];
-			SDL_GetErrorMsg(errstr, sizeof(errstr));
-			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-				     "Unable to convert texture to surface for "
-				     "cache dump: %s",
-				     errstr);
-			continue;
-		}
+			struct packed_surface *ps = &ctx->pack[i];
 
-		SDL_LockSurface(s);
-		qd.width = s->w;
-		qd.height = s->h;
-		qd.colorspace = QOI_LINEAR;
-		qd.channels = SDL_BYTESPERPIXEL(s->format->format);
-		qoi_img = qoi_encode(s->pixels, &qd, &out_len);
-		SDL_UnlockSurface(s);
-		SDL_FreeSurface(s);
+			if(ps->used != (pass == 0 ? SDL_TRUE : SDL_FALSE))
+				continue;
 
-		{
-			SDL_RWops *rw;
-			char filename[32];
+			if(data_len + ps->len > CACHE_PACK_MAX_BYTES)
+				continue;
 
-			SDL_snprintf(filename, sizeof(filename),
-				"%" PRIhashX ".qoi", t->label_hash);
-			rw = SDL_RWFromFile(filename, "wb");
-			SDL_RWwrite(rw, qoi_img, 1, out_len);
-			SDL_RWclose(rw);
+			data_len += ps->len;
+			stb_arr_push(save, ps);
 		}
+	}
 
-		SDL_free(qoi_img);
+	rw = SDL_RWFromFile(ctx->pack_path, "wb");
+	if(rw == NULL)
+	{
+		SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Unable to save texture pack: %s", SDL_GetError());
+		goto out;
+	}
+
+	write_le32(hdr, CACHE_PACK_MAGIC);
+	write_le32(hdr + 4, CACHE_PACK_VERSION);
+	write_le32(hdr + 8, stb_arr_len(save));
+	write_le32(hdr + 12, 0);
+	SDL_RWwrite(rw, hdr, sizeof(hdr), 1);
+
+	data_len = 0;
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(save); i++)
+	{
+		Uint8 rec[CACHE_PACK_RECORD_SZ];
+
+		write_le32(rec, (Uint32)save[i]->key);
+		write_le32(rec + 4, (Uint32)(save[i]->key >> 32));
+		write_le32(rec + 8, data_len);
+		write_le32(rec + 12, save[i]->len);
+		SDL_RWwrite(rw, rec, sizeof(rec), 1);
+		data_len += save[i]->len;
+	}
+
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(save); i++)
+		SDL_RWwrite(rw, save[i]->qoi, save[i]->len, 1);
+
+	if(SDL_RWclose(rw) != 0)
+	{
+		SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Unable to save texture pack: %s", SDL_GetError());
+		goto out;
+	}
+
+	ctx->pack_dirty = SDL_FALSE;
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Saved %d bitmaps to texture pack '%s'",
+		stb_arr_len(save), ctx->pack_path);
+
+out:
+	stb_arr_free(save);
+}
+
+static void free_texture_pack(cache_ctx_s *ctx)
+{
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(ctx->pack); i++)
+	{
+		if(ctx->pack[i].owned == SDL_TRUE)
+			SDL_free((void *)ctx->pack[i].qoi);
 	}
+
+	stb_arr_free(ctx->pack);
+	SDL_free(ctx->pack_file);
+	SDL_free(ctx->pack_path);
+	ctx->pack = NULL;
+	ctx->pack_file = NULL;
+	ctx->pack_path = NULL;
 }
 
 static void delete_cached_texture_loc(cache_ctx_s *HEDLEY_RESTRICT ctx,
-	unsigned loc)
+	Uint32 slot)
 {
+	unsigned loc = ctx->index[slot] - 1;
+	unsigned last = stb_arr_lastn(ctx->cached_ui);
+
 	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
 		"Deleting texture at location %u", loc);
+	release_cached_tex(ctx, ctx->cached_ui[loc].ct);
+	cache_index_remove(ctx, slot);
+
+	/* The last entry is about to be moved into the deleted location, so
+	 * its index slot must point to the new location. */
+	if(loc != last)
+	{
+		const struct textures *t = &ctx->cached_ui[last];
+		Uint32 moved = cache_index_find(ctx, t->data_origin, t->part,
+			t->generation);
+		ctx->index[moved] = loc + 1;
+	}
+
 	stb_arr_fastdelete(ctx->cached_ui, loc);
 }
 
-HEDLEY_NON_NULL(1,4)
-SDL_Texture *get_cached_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
-	ui_texture_part_e part,
-	Hash label_hash, const struct ui_element *HEDLEY_RESTRICT el)
+/**
+ * Evicts a single entry from the cache. Entries are selected with the CLOCK
+ * algorithm; an entry that was used since the hand last passed it is given a
+ * second chance.
+ *
+ * \return	SDL_FALSE if the cache is empty.
+ */
+static SDL_bool evict_next_cached_texture(cache_ctx_s *ctx)
 {
-	unsigned count;
+	while(stb_arr_len(ctx->cached_ui) > 0)
+	{
+		struct textures *t;
+		Uint32 slot;
 
-	SDL_assert_paranoid(el->label != NULL);
-	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
-		"Looking up %s texture for label '%s' ( %" PRIhashX " %p)",
-		part_str[part], el->label, label_hash, (void *)el);
+		if(ctx->clock_hand >= (unsigned)stb_arr_len(ctx->cached_ui))
+			ctx->clock_hand = 0;
 
-	count = stb_arr_len(ctx->cached_ui);
+		t = &ctx->cached_ui[ctx->clock_hand];
+		if(t->referenced == SDL_TRUE)
+		{
+			t->referenced = SDL_FALSE;
+			ctx->clock_hand++;
+			continue;
+		}
+
+		ctx->stats.evictions++;
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Evicting %s texture for %p (%lu bytes)",
+			part_str[t->part], t->data_origin,
+			(unsigned long)t->ct->bytes);
+
+		/* The last entry is moved to the location of the hand, so the
+		 * hand does not advance. */
+		slot = cache_index_find(ctx, t->data_origin, t->part,
+			t->generation);
+		delete_cached_texture_loc(ctx, slot);
+		return SDL_TRUE;
+	}
+
+	return SDL_FALSE;
+}
+
+/**
+ * Evicts every entry within the shared page that was least recently used, so
+ * that the page is emptied. Evicting single entries until a page happens to
+ * empty could evict most of the cache. Pages are ranked by the number of their
+ * entries that were used since a page was last evicted, and then by the number
+ * of bitmaps that they hold. The usage of all entries is then cleared.
+ *
+ * \return	SDL_FALSE if no shared page holds any bitmaps.
+ */
+static SDL_bool evict_atlas_page(cache_ctx_s *ctx)
+{
+	const unsigned count = stb_arr_len(ctx->pages);
+	struct atlas_page *victim = NULL;
+
+	for(unsigned i = 0; i < count; i++)
+		ctx->pages[i]->referenced = 0;
+
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(ctx->cached_ui); i++)
+	{
+		if(ctx->cached_ui[i].referenced == SDL_TRUE)
+			ctx->cached_ui[i].ct->page->referenced++;
+	}
 
 	for(unsigned i = 0; i < count; i++)
 	{
-		if(el != ctx->cached_ui[i].data_origin)
+		struct atlas_page *page = ctx->pages[i];
+
+		if(page->dedicated == SDL_TRUE || page->live == 0)
 			continue;
 
-		if(part != ctx->cached_ui[i].part)
+		if(victim == NULL || page->referenced < victim->referenced ||
+			(page->referenced == victim->referenced &&
+				page->live < victim->live))
+			victim = page;
+	}
+
+	if(victim == NULL)
+		return SDL_FALSE;
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Evicting atlas page with %u bitmaps, %u recently used",
+		victim->live, victim->referenced);
+
+	/* The page is reset or retired once its last bitmap is released, so
+	 * it must not be accessed after the loop. */
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(ctx->cached_ui);)
+	{
+		struct textures *t = &ctx->cached_ui[i];
+		Uint32 slot;
+
+		if(t->ct->page != victim)
+		{
+			t->referenced = SDL_FALSE;
+			i++;
 			continue;
+		}
+
+		/* The last entry is moved to this location. */
+		ctx->stats.evictions++;
+		slot = cache_index_find(ctx, t->data_origin, t->part,
+			t->generation);
+		delete_cached_texture_loc(ctx, slot);
+	}
+
+	return SDL_TRUE;
+}
+
+/**
+ * Evicts shared pages until pages of the given number of further bytes fit
+ * within the budget of the cache, or until no shared page holds any bitmaps.
+ * Pages that are emptied are retired, rather than kept for reuse.
+ */
+static void evict_atlas_pages(cache_ctx_s *ctx, size_t bytes)
+{
+	while(ctx->page_bytes + bytes > ctx->budget)
+	{
+		unsigned count = stb_arr_len(ctx->pages);
+		unsigned i;
 
-		if(label_hash != ctx->cached_ui[i].label_hash)
+		for(i = 0; i < count; i++)
 		{
-			SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
-				"Found %s texture for %p at location %u, "
-				"but label hash changed from %" PRIhashX " "
-				"to %" PRIhashX,
-				part_str[part], (void *)el, i,
-				ctx->cached_ui[i].label_hash, label_hash);
-			delete_cached_texture_loc(ctx, i);
-			break;
+			if(ctx->pages[i]->live == 0)
+				break;
 		}
 
-		/* TODO: Check for any differences in the two elements. */
+		if(i < count)
+			atlas_remove_page(ctx, ctx->pages[i]);
+		else if(evict_atlas_page(ctx) == SDL_FALSE)
+			break;
+	}
+}
+
+/**
+ * Evicts entries until the given number of bytes fits within the budget of
+ * the cache, or until the cache is empty.
+ */
+static void evict_cached_textures(cache_ctx_s *ctx, size_t bytes)
+{
+	while(ctx->bytes + bytes > ctx->budget &&
+		evict_next_cached_texture(ctx) == SDL_TRUE)
+		continue;
+}
+
+HEDLEY_NON_NULL(1,4,6)
+SDL_Texture *get_cached_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
+	ui_texture_part_e part,
+	Hash label_hash, const struct ui_element *HEDLEY_RESTRICT el,
+	Uint64 content_key, SDL_Rect *HEDLEY_RESTRICT src)
+{
+	Uint32 slot;
+	struct textures *t;
+
+	/* Lookups are not logged, as this is called for every element drawn
+	 * in every frame. Use get_cache_stats() instead. */
+	SDL_assert_paranoid(el->label != NULL);
+
+	if(ctx->index == NULL)
+		goto miss;
+
+	slot = cache_index_find(ctx, el, part, ctx->generation);
+	if(ctx->index[slot] == 0)
+		goto miss;
 
+	t = &ctx->cached_ui[ctx->index[slot] - 1];
+	if(label_hash != t->label_hash ||
+		element_fingerprint(el) != t->fingerprint)
+	{
 		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
-			"Successfully found %s texture for %p",
-			part_str[part], (void *)el);
-		return ctx->cached_ui[i].tex;
+			"Found %s texture for %p at location %u, "
+			"but the label hash changed from %" PRIhashX " "
+			"to %" PRIhashX " or the element changed",
+			part_str[part], (void *)el, ctx->index[slot] - 1,
+			t->label_hash, label_hash);
+		ctx->stats.stale++;
+		delete_cached_texture_loc(ctx, slot);
+		goto miss;
 	}
 
-	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
-		"No texture found for %" PRIhashX " %p",
-		label_hash, (void *)el);
+	/* The element is unchanged, but its bitmap is required with other
+	 * content, such as a label truncated to another width, or a draft
+	 * that is still awaiting the full bitmap. The entry is replaced once
+	 * the bitmap with the required content is obtained. */
+	if(content_key != t->content_key)
+		goto miss;
 
+	t->referenced = SDL_TRUE;
+	ctx->stats.hits++;
+	*src = t->ct->src;
+	return t->ct->page->tex;
+
+miss:
+	ctx->stats.misses++;
 	return NULL;
 }
 
-HEDLEY_NON_NULL(1,4,5)
-void store_cached_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
-		ui_texture_part_e part,
-		Hash label_hash, const struct ui_element *HEDLEY_RESTRICT el,
-		SDL_Texture *HEDLEY_RESTRICT tex)
+/**
+ * Adds an entry for part of an element that refers to a cached bitmap,
+ * replacing any existing entry for that part. The caller's reference to the
+ * bitmap is transferred to the new entry.
+ *
+ * \return	0 on success, or -1 on error, in which case the reference to the
+ *		bitmap is released.
+ */
+static int cache_add_entry(cache_ctx_s *HEDLEY_RESTRICT ctx,
+	ui_texture_part_e part, Hash label_hash,
+	const struct ui_element *HEDLEY_RESTRICT el, struct cached_tex *ct)
 {
 	struct textures new_entry;
-
-	SDL_assert_paranoid(el->label != NULL);
+	Uint32 slot;
 
 	/* Part of the UI element that the texture represents. */
 	new_entry.part = part;
@@ -204,33 +1647,269 @@ void store_cached_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
 	 * to find out whether data from the same UI element has changed or
 	 * not. */
 	new_entry.data_origin = el;
-	/* Holding a copy of the element data to compare with the element
+	/* A fingerprint of the element data to compare with the element
 	 * data when fetching the texture from cache. If any of this data has
 	 * changed, then we know that the cached texture is stale. This is
 	 * useful in case the label doesn't change, but other parameters of
 	 * the element do. */
-	SDL_memcpy(&new_entry.el, el, sizeof(*el));
-	/* The rendered texture to store into the cache. */
-	new_entry.tex = tex;
+	new_entry.fingerprint = element_fingerprint(el);
+	new_entry.generation = ctx->generation;
+	new_entry.content_key = ct->content_key;
+	new_entry.ct = ct;
+	new_entry.referenced = SDL_TRUE;
+
+	/* Replace any existing entry for this part of the element. */
+	if(ctx->index != NULL)
+	{
+		slot = cache_index_find(ctx, el, part, ctx->generation);
+		if(ctx->index[slot] != 0)
+			delete_cached_texture_loc(ctx, slot);
+	}
+
+	/* Keep the index at most half full so that probe sequences remain
+	 * short. */
+	if(ctx->index == NULL ||
+		(Uint32)stb_arr_len(ctx->cached_ui) >= ctx->index_mask / 2)
+	{
+		Uint32 slots = ctx->index == NULL ?
+			CACHE_INDEX_MIN_SLOTS : (ctx->index_mask + 1) * 2;
+
+		if(cache_index_rebuild(ctx, slots) != 0)
+		{
+			SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_CACHE,
+				"Unable to grow cache index; texture not "
+				"stored");
+			release_cached_tex(ctx, ct);
+			return -1;
+		}
+	}
+
+	/* FIXME: does not error on out of memory exception. */
+	slot = cache_index_find(ctx, el, part, ctx->generation);
+	stb_arr_push(ctx->cached_ui, new_entry);
+	ctx->index[slot] = stb_arr_len(ctx->cached_ui);
+
+	return 0;
+}
+
+HEDLEY_NON_NULL(1,4,6)
+SDL_Texture *get_shared_texture(cache_ctx_s *HEDLEY_RESTRICT ctx,
+	ui_texture_part_e part,
+	Hash label_hash, const struct ui_element *HEDLEY_RESTRICT el,
+	Uint64 content_key, SDL_Rect *HEDLEY_RESTRICT src)
+{
+	struct cached_tex *ct;
+
+	if(ctx->shared == NULL)
+		return NULL;
+
+	ct = ctx->shared[shared_find(ctx, content_key)];
+	if(ct == NULL)
+		return NULL;
+
+	/* Hold a reference before any existing entry for this element is
+	 * replaced, as that entry may be the only other reference. */
+	ct->refs++;
+	if(cache_add_entry(ctx, part, label_hash, el, ct) != 0)
+		return NULL;
+
+	ctx->stats.shared_hits++;
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Sharing %s texture for '%s' (%p) with %u other entries",
+		part_str[part], el->label, (void *)el, ct->refs - 1);
+
+	*src = ct->src;
+	return ct->page->tex;
+}
+
+HEDLEY_NON_NULL(1,4,6,7)
+SDL_Texture *store_cached_surface(cache_ctx_s *HEDLEY_RESTRICT ctx,
+		ui_texture_part_e part,
+		Hash label_hash, const struct ui_element *HEDLEY_RESTRICT el,
+		Uint64 content_key, SDL_Surface *HEDLEY_RESTRICT surf,
+		SDL_Rect *HEDLEY_RESTRICT src)
+{
+	struct cached_tex *ct;
+	Uint32 slot;
+
+	SDL_assert_paranoid(el->label != NULL);
+
+	/* Make room for the bitmap, including its padding, before it is
+	 * copied into the atlas. */
+	evict_cached_textures(ctx, (size_t)(surf->w + CACHE_ATLAS_PADDING * 2) *
+		(size_t)(surf->h + CACHE_ATLAS_PADDING * 2) *
+		SDL_BYTESPERPIXEL(ctx->page_format));
+
+	/* Release any existing bitmap for this part of the element before a
+	 * new bitmap is allocated. */
+	if(ctx->index != NULL)
+	{
+		slot = cache_index_find(ctx, el, part, ctx->generation);
+		if(ctx->index[slot] != 0)
+			delete_cached_texture_loc(ctx, slot);
+	}
+
+	/* The rendered bitmap to store into the cache. */
+	ct = atlas_upload(ctx, surf, content_key);
+	if(ct == NULL)
+	{
+		SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Unable to copy %s bitmap into atlas: %s",
+			part_str[part], SDL_GetError());
+		return NULL;
+	}
 
 	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
 		"Stored %s texture: '%s' (%" PRIhashX " %p)",
 		part_str[part], el->label, label_hash, (void *)el);
 
-	/* FIXME: does not error on out of memory exception. */
-	stb_arr_push(ctx->cached_ui, new_entry);
+	if(cache_add_entry(ctx, part, label_hash, el, ct) != 0)
+		return NULL;
+
+	shared_insert(ctx, ct);
+
+	*src = ct->src;
+	return ct->page->tex;
+}
+
+/**
+ * Counts the bits of alpha within a pixel format.
+ */
+static int atlas_alpha_bits(Uint32 format)
+{
+	Uint32 r, g, b, a;
+	int bpp, bits = 0;
+
+	if(SDL_ISPIXELFORMAT_FOURCC(format) ||
+		SDL_PixelFormatEnumToMasks(format, &bpp, &r, &g, &b, &a) ==
+			SDL_FALSE)
+		return 0;
+
+	for(; a != 0; a &= a - 1)
+		bits++;
+
+	return bits;
+}
+
+/**
+ * Selects the pixel format for atlas pages. Text is antialiased, so formats
+ * with fewer than eight bits of alpha would band its edges. ARGB8888 is
+ * preferred, as bitmaps are rendered in that format and are not converted
+ * when uploaded. Renderers that do not support it, such as that of the PSP,
+ * use a format with enough alpha that they support natively.
+ */
+static Uint32 atlas_select_format(const SDL_RendererInfo *info)
+{
+	for(Uint32 i = 0; i < info->num_texture_formats; i++)
+	{
+		if(info->texture_formats[i] == SDL_PIXELFORMAT_ARGB8888)
+			return SDL_PIXELFORMAT_ARGB8888;
+	}
+
+	for(Uint32 i = 0; i < info->num_texture_formats; i++)
+	{
+		if(atlas_alpha_bits(info->texture_formats[i]) >= 8)
+			return info->texture_formats[i];
+	}
+
+	return SDL_PIXELFORMAT_ARGB8888;
 }
 
-cache_ctx_s *init_cached_texture(void)
+cache_ctx_s *init_cached_texture(SDL_Renderer *rend)
 {
 	cache_ctx_s *ctx;
+	SDL_RendererInfo rend_info;
+
 	ctx = SDL_calloc(1, sizeof(struct cache_ctx));
+	if(ctx == NULL)
+		return NULL;
+
+	ctx->rend = rend;
+	ctx->budget = CACHE_DEFAULT_BUDGET;
+	ctx->page_w = CACHE_ATLAS_PAGE_SIZE;
+	ctx->page_h = CACHE_ATLAS_PAGE_SIZE;
+	ctx->page_format = SDL_PIXELFORMAT_ARGB8888;
+
+	if(SDL_GetRendererInfo(rend, &rend_info) == 0)
+	{
+		ctx->page_format = atlas_select_format(&rend_info);
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+			"Using %s atlas pages",
+			SDL_GetPixelFormatName(ctx->page_format));
+
+		/* A maximum size of zero means that there is no limit. */
+		if(rend_info.max_texture_width > 0)
+			ctx->page_w = SDL_min(ctx->page_w,
+				rend_info.max_texture_width);
+		if(rend_info.max_texture_height > 0)
+			ctx->page_h = SDL_min(ctx->page_h,
+				rend_info.max_texture_height);
+	}
+
 	return ctx;
 }
 
+void set_cached_texture_generation(cache_ctx_s *ctx, Uint32 generation)
+{
+	SDL_assert_paranoid(ctx != NULL);
+
+	if(ctx->generation == generation)
+		return;
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Font size generation changed from %08" SDL_PRIX32 " to "
+		"%08" SDL_PRIX32, ctx->generation, generation);
+	ctx->generation = generation;
+}
+
+HEDLEY_NON_NULL(1,2)
+void get_cache_stats(const cache_ctx_s *HEDLEY_RESTRICT ctx,
+	struct ui_cache_stats *HEDLEY_RESTRICT stats)
+{
+	*stats = ctx->stats;
+	stats->entries = stb_arr_len(ctx->cached_ui);
+	stats->bitmaps = ctx->bitmaps;
+	stats->bytes = ctx->bytes;
+	stats->budget = ctx->budget;
+	stats->pages = stb_arr_len(ctx->pages);
+	stats->page_bytes = ctx->page_bytes;
+}
+
+void set_cached_texture_budget(cache_ctx_s *ctx, size_t bytes)
+{
+	SDL_assert_paranoid(ctx != NULL);
+	ctx->budget = bytes;
+
+	/* Evicting entries alone may leave every page partly used. Bitmaps
+	 * within dedicated pages are only evicted as entries. */
+	evict_atlas_pages(ctx, 0);
+	evict_cached_textures(ctx, 0);
+}
+
 void deinit_cached_texture(cache_ctx_s *ctx)
 {
 	SDL_assert_paranoid(ctx != NULL);
+
+	dump_finish(ctx, SDL_TRUE);
+	clear_cached_textures(ctx);
+
+	/* Destroy all pooled render targets along with any retired textures. */
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(ctx->pool); i++)
+		stb_arr_push(ctx->retired, ctx->pool[i].tex);
+
+	stb_arr_free(ctx->pool);
+
+	/* Empty pages are retained for reuse until the context is freed. */
+	while(stb_arr_len(ctx->pages) > 0)
+		atlas_remove_page(ctx, ctx->pages[0]);
+
+	stb_arr_free(ctx->pages);
+	destroy_retired_textures(ctx);
+	free_texture_pack(ctx);
+	stb_arr_free(ctx->retired);
+
+	SDL_free(ctx->index);
+	SDL_free(ctx->shared);
 	SDL_free(ctx);
 	ctx = NULL;
 }
@@ -248,8 +1927,14 @@ void clear_cached_textures(cache_ctx_s *ctx)
 	}
 
 	count = stb_arr_len(ctx->cached_ui);
+	for(unsigned i = 0; i < count; i++)
+		release_cached_tex(ctx, ctx->cached_ui[i].ct);
+
 	stb_arr_free(ctx->cached_ui);
 	ctx->cached_ui = NULL;
+	ctx->bytes = 0;
+	ctx->clock_hand = 0;
+	SDL_memset(ctx->index, 0, (ctx->index_mask + 1) * sizeof(*ctx->index));
 	SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
 		     "Cleared %d cached textures", count);
 }
@@ -13,8 +13,11 @@
 
 #include "all.h"
 #include "font.h"
+#include "fontindex.h"
 #include "SDL.h"
 #include "SDL_ttf.h"
+#include "stb_arr.h"
+#include "wyhash.h"
 
 #ifndef NO_FRIBIDI
 # define DONT_HAVE_FRIBIDI_CONFIG_H
@@ -25,26 +28,1692 @@
 #if defined(__WIN32__)
 # define WINDOWS_LEAN_AND_MEAN
 # include <Windows.h>
+# define FONT_MAP_WIN32
+#elif defined(__LINUX__) || defined(__MACOSX__) || defined(__FREEBSD__)
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# define FONT_MAP_POSIX
 #endif
 
 /* Maximum number of fonts to preload. */
 #define MAX_FONTS 8
 
+/* Index of the regular font that is used when no other font provides a code
+ * point. Its slot follows those of the other regular fonts. */
+#define FONT_FALLBACK MAX_FONTS
+
+#ifndef NO_UNIFONT
+/* Unifont, generated from ext/fonts/unifont-13.0.06.woff2 when building. */
+extern const unsigned char unifont_woff2[];
+extern const unsigned long unifont_woff2_len;
+#endif
+
+/* Preferred size of glyph atlas textures. */
+#define GLYPH_ATLAS_SIZE 512
+
+/* Transparent border between glyphs in the atlas. */
+#define GLYPH_ATLAS_PADDING 1
+
+/* Initial number of slots in a glyph table. Must be a power of two. */
+#define GLYPH_TABLE_MIN_SLOTS 128
+
+/* Code points whose advances and kerning are kept in direct tables for text
+ * measurement. */
+#define FONT_METRICS_ASCII 128
+
+/* Marks kerning between a pair of code points that is not yet obtained. */
+#define FONT_KERN_UNKNOWN SDL_MIN_SINT8
+
+/* Appended to text that is truncated. Full stops are used instead if the font
+ * does not provide an ellipsis. */
+#define FONT_ELLIPSIS_CP 0x2026
+#define FONT_ELLIPSIS "\xE2\x80\xA6"
+#define FONT_ELLIPSIS_ASCII "..."
+
+/* Point size that fonts are opened at, at the default DPI of FreeType, before
+ * they are first set to a size. */
+#define FONT_OPEN_PT 12
+#define FONT_OPEN_DPI 72
+
+/* DPI that glyphs are rasterised at when scaled glyphs are enabled. Glyphs are
+ * mostly scaled down from this size, which looks better than scaling up. */
+#define GLYPH_SCALED_REF_DPI 192
+
+/* Code points whose availability is recorded for each regular font. Code
+ * points outside of the Basic Multilingual Plane are checked when used. */
+#define FONT_COVERAGE_CP 0x10000
+
+/* Name of the index of installed fonts within the preference path. */
+#define FONT_INDEX_FILENAME "fonts.hyfi"
+
+/* Maximum number of threads that render text in the background. */
+#define FONT_WORKERS_MAX 2
+
+/* Number of font sets kept open at recently used sizes, in addition to the
+ * fonts at the current size. */
+#define FONT_POOL_SIZE 3
+
+#ifndef NO_FRIBIDI
+/* Number of strings whose visual order is kept by each font set. Must be a
+ * power of two. */
+#define FONT_BIDI_CACHE_SLOTS 64
+
+/**
+ * Buffers used to reorder bidirectional text, which are reused between
+ * strings, and the visual order of recently reordered strings.
+ */
+struct font_bidi
+{
+	/* Code points in logical and visual order. */
+	FriBidiChar *logical;
+	FriBidiChar *visual;
+
+	struct
+	{
+		/* Hash of the string in logical order. */
+		Uint64 hash;
+		/* UTF-8 string in visual order, or NULL if the slot is
+		 * unused. */
+		char *utf8;
+	} cache[FONT_BIDI_CACHE_SLOTS];
+};
+#endif
+
+/**
+ * Point sizes and DPI that fonts are set to.
+ */
+struct font_size
+{
+	int pt[FONT_STYLE_MAX];
+	unsigned hdpi, vdpi;
+};
+
+/**
+ * A glyph held within a glyph atlas.
+ */
+struct font_glyph
+{
+	/* Code point of the glyph. Zero marks an empty slot. */
+	Uint32 cp;
+
+	/* Font that rendered the glyph, used to apply kerning. */
+	TTF_Font *font;
+
+	/* Location of the glyph bitmap within the atlas. */
+	SDL_Rect src;
+
+	/* Offset of the bitmap from the pen position, and the distance to
+	 * advance the pen by. */
+	int offset_x;
+	int advance;
+};
+
+/**
+ * Texture holding rendered glyphs of a single font style, at the size of the
+ * set of fonts that rendered them. Glyphs are rendered in white and are
+ * tinted when drawn.
+ */
+struct glyph_atlas
+{
+	SDL_Texture *tex;
+	int w, h;
+
+	/* Position of the next glyph, and height of the current row. */
+	int x, y, row_h;
+
+	/* Open-addressing table of glyphs by code point, using linear
+	 * probing. The number of slots is always a power of two. */
+	struct font_glyph *glyphs;
+	Uint32 glyph_mask;
+	unsigned glyph_count;
+};
+
+/**
+ * Distance that a code point advances the pen by.
+ */
+struct font_advance
+{
+	/* Code point. Zero marks an empty slot. */
+	Uint32 cp;
+
+	/* Font that renders the code point, or NULL if the advance is not yet
+	 * obtained. */
+	TTF_Font *font;
+	int advance;
+};
+
+/**
+ * Advances and kerning of a single font style at the size of a set of fonts,
+ * used to measure text without rendering it.
+ */
+struct font_metrics
+{
+	/* Advances of ASCII code points, indexed by code point. */
+	struct font_advance ascii[FONT_METRICS_ASCII];
+
+	/* Kerning between pairs of ASCII code points, or FONT_KERN_UNKNOWN. */
+	Sint8 kern[FONT_METRICS_ASCII][FONT_METRICS_ASCII];
+
+	/* Open-addressing table of advances of other code points, using
+	 * linear probing. The number of slots is always a power of two. */
+	struct font_advance *table;
+	Uint32 mask;
+	unsigned count;
+};
+
+/**
+ * A set of opened fonts. Each thread that renders text uses its own set, as a
+ * font cannot be used by more than one thread at a time.
+ */
+struct font_set
+{
+	TTF_Font *ui_header;
+	TTF_Font *ui_icons;
+
+	/* The fallback font is not held by the set; see font_regular(). */
+	TTF_Font *ui_regular[MAX_FONTS];
+
+	/* Regular fonts that are discovered after the set is opened are opened
+	 * when first needed. Bit i is set if regular font i could not be
+	 * opened, so that it is not tried again. */
+	unsigned regular_failed;
+
+	/* Sizes that the fonts are set to. */
+	struct font_size size;
+
+	/* Set if the set is used by a worker, which never uses the fallback
+	 * font. */
+	SDL_bool worker;
+
+	/* Glyphs rasterised by these fonts for font_draw_text() and
+	 * font_draw_icon(), and metrics used by font_measure_text(). Only
+	 * used by sets of the render thread, and kept whilst a set is in the
+	 * pool, so that nothing is rasterised again when returning to its
+	 * size. Emptied when the size of the set changes. */
+	struct glyph_atlas atlas[FONT_STYLE_MAX];
+	struct font_metrics metrics[FONT_STYLE_MAX];
+
+	/* Icons drawn that were not placed within the icon atlas by
+	 * font_set_icons(). */
+	struct glyph_atlas icon_overflow;
+
+	/* Set once the icons set by font_set_icons() are rasterised into the
+	 * icon atlas. */
+	SDL_bool icons_ready;
+
+#ifndef NO_FRIBIDI
+	/* Only used by the thread that owns the set. The visual order of a
+	 * string does not depend on font size, so it is kept when font sizes
+	 * change. */
+	struct font_bidi bidi;
+#endif
+};
+
+/**
+ * A request to render text or an icon in the background.
+ */
+struct font_job
+{
+	Uint64 id;
+
+	/* String to render, or NULL to render an icon. */
+	char *str;
+	Uint16 icon;
+
+	font_style_e style;
+	font_quality_e quality;
+	SDL_Colour fg;
+	int max_w;
+
+	/* Font sizes at the time of the request. */
+	struct font_size size;
+};
+
+struct font_result
+{
+	Uint64 id;
+	/* Rendered surface, or NULL if rendering failed. */
+	SDL_Surface *surf;
+};
+
+struct font_worker
+{
+	font_ctx_s *ctx;
+	SDL_Thread *thread;
+
+	/* Fonts used only by this worker. */
+	struct font_set fonts;
+};
+
 struct font_ctx
 {
-	SDL_Renderer *rend;
-	int tex_min_w, tex_min_h;
-	TTF_Font *ui_header;
-	TTF_Font *ui_icons;
-	TTF_Font *ui_regular[MAX_FONTS];
-};
+	SDL_Renderer *rend;
+	int tex_min_w, tex_min_h;
+
+	/* Fonts used by the render thread. */
+	struct font_set fonts;
+
+	/* Fonts previously used by the render thread at other sizes, most
+	 * recently used first. Sets that are not yet used have no fonts. */
+	struct font_set pool[FONT_POOL_SIZE];
+
+	/* Number of regular fonts that are available. Fonts discovered
+	 * through the index are added under open_lock, and the count is
+	 * published after the location and coverage of the new font are
+	 * recorded. Entries below the count are never changed, so they are
+	 * shared by all threads. */
+	SDL_atomic_t regular_count;
+
+	/* Locations of regular fonts that were opened from files, so that
+	 * other font sets may open their own instances. NULL for built-in
+	 * fonts. */
+	char *regular_path[MAX_FONTS];
+
+	/* Bitmap of the code points provided by each regular font. Only
+	 * recorded if fonts are selected per code point. Never recorded for
+	 * the fallback font. */
+	Uint8 *coverage[MAX_FONTS + 1];
+
+	/* Installed fonts that provide code points that the loaded fonts do
+	 * not, or NULL if fonts cannot be discovered on this platform. */
+	font_index_s *index;
+
+#ifndef NO_UNIFONT
+	/* FreeType decompresses the whole of Unifont when it is opened, so a
+	 * single instance is shared by the sets used by the render thread,
+	 * and is set to the size of each set as it is used. Text that
+	 * requires Unifont is never rendered by workers. Opened when first
+	 * needed. */
+	TTF_Font *unifont;
+	struct font_size unifont_size;
+	/* Set once Unifont has failed to open. Read by workers. */
+	SDL_atomic_t unifont_failed;
+#endif
+
+	/* Serialises opening and closing fonts, as all fonts share a single
+	 * FreeType library instance, and protects index. */
+	SDL_mutex *open_lock;
+
+	/* Icons set by font_set_icons(), which are rasterised into the icon
+	 * atlas of each set of fonts as it is used. */
+	Uint16 *icons;
+
+	/* Whether glyphs in the atlases are rasterised once at a reference
+	 * size by scaled_fonts and scaled when drawn, rather than being
+	 * rasterised by fonts at the current size. */
+	SDL_bool scaled;
+	struct font_set scaled_fonts;
+
+	/* Background rendering. The queues are protected by jobs_lock. */
+	struct font_worker workers[FONT_WORKERS_MAX];
+	unsigned worker_count;
+	SDL_mutex *jobs_lock;
+	SDL_cond *jobs_cond;
+	struct font_job *jobs;
+	struct font_result *results;
+	SDL_bool quit;
+};
+
+/**
+ * Decodes the next code point of a UTF-8 string. Malformed sequences are
+ * returned as the replacement character.
+ *
+ * \param str	Position within the string, advanced past the code point.
+ * \return	Code point.
+ */
+static Uint32 font_utf8_next(const char **str)
+{
+	const Uint8 *s = (const Uint8 *)*str;
+	Uint32 cp;
+	unsigned len;
+
+	if(s[0] < 0x80)
+	{
+		cp = s[0];
+		len = 1;
+	}
+	else if((s[0] & 0xE0) == 0xC0)
+	{
+		cp = s[0] & 0x1F;
+		len = 2;
+	}
+	else if((s[0] & 0xF0) == 0xE0)
+	{
+		cp = s[0] & 0x0F;
+		len = 3;
+	}
+	else if((s[0] & 0xF8) == 0xF0)
+	{
+		cp = s[0] & 0x07;
+		len = 4;
+	}
+	else
+	{
+		*str += 1;
+		return 0xFFFD;
+	}
+
+	for(unsigned i = 1; i < len; i++)
+	{
+		/* Also stops at the end of a truncated string. */
+		if((s[i] & 0xC0) != 0x80)
+		{
+			*str += i;
+			return 0xFFFD;
+		}
+
+		cp = (cp << 6) | (s[i] & 0x3F);
+	}
+
+	*str += len;
+	return cp;
+}
+
+static TTF_Font *font_open_mem(const void *mem, size_t len)
+{
+	SDL_RWops *font_mem;
+
+	font_mem = SDL_RWFromConstMem(mem, (int)len);
+	return TTF_OpenFontRW(font_mem, 1, FONT_OPEN_PT);
+}
+
+#if defined(FONT_MAP_WIN32) || defined(FONT_MAP_POSIX)
+static void font_unmap(void *base, size_t len)
+{
+#if defined(FONT_MAP_WIN32)
+	(void)len;
+	UnmapViewOfFile(base);
+#else
+	munmap(base, len);
+#endif
+}
+
+static int font_unmap_close(SDL_RWops *rw)
+{
+	font_unmap(rw->hidden.mem.base,
+		(size_t)(rw->hidden.mem.stop - rw->hidden.mem.base));
+	SDL_FreeRW(rw);
+	return 0;
+}
+#endif
+
+/**
+ * Opens a font file by mapping it into memory. Only the parts of the file
+ * that are read are loaded, and they may be paged out by the operating system
+ * when unused, which suits large fonts of which few glyphs are used.
+ *
+ * \param loc	Location of the font file.
+ * \return	Read-only stream, or NULL on error. The file is read normally
+ *		if it cannot be mapped.
+ */
+static SDL_RWops *font_map_file(const char *loc)
+{
+	SDL_RWops *rw = NULL;
+	void *base = NULL;
+	size_t len = 0;
+
+#if defined(FONT_MAP_WIN32)
+	HANDLE file, map;
+	LARGE_INTEGER sz;
+
+	file = CreateFileA(loc, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		goto out;
+
+	if(GetFileSizeEx(file, &sz) != 0 && sz.QuadPart > 0 &&
+		sz.QuadPart <= SDL_MAX_SINT32)
+	{
+		map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(map != NULL)
+		{
+			/* The view keeps the mapping open. */
+			base = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			len = (size_t)sz.QuadPart;
+			CloseHandle(map);
+		}
+	}
+
+	CloseHandle(file);
+#elif defined(FONT_MAP_POSIX)
+	struct stat st;
+	int fd;
+
+	fd = open(loc, O_RDONLY);
+	if(fd < 0)
+		goto out;
+
+	if(fstat(fd, &st) == 0 && st.st_size > 0 &&
+		st.st_size <= SDL_MAX_SINT32)
+	{
+		len = (size_t)st.st_size;
+		base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(base == MAP_FAILED)
+			base = NULL;
+	}
+
+	/* The mapping remains valid after the file is closed. */
+	close(fd);
+#endif
+
+#if defined(FONT_MAP_WIN32) || defined(FONT_MAP_POSIX)
+	if(base == NULL)
+		goto out;
+
+	rw = SDL_RWFromConstMem(base, (int)len);
+	if(rw == NULL)
+	{
+		font_unmap(base, len);
+		goto out;
+	}
+
+	rw->close = font_unmap_close;
+	return rw;
+
+out:
+#endif
+	(void)base;
+	(void)len;
+	return SDL_RWFromFile(loc, "rb");
+}
+
+/**
+ * Opens a font file. The file is mapped into memory rather than read.
+ *
+ * \return	Font, or NULL on error.
+ */
+static TTF_Font *font_open_file(const char *loc)
+{
+	SDL_RWops *rw = font_map_file(loc);
+
+	if(rw == NULL)
+		return NULL;
+
+	return TTF_OpenFontRW(rw, 1, FONT_OPEN_PT);
+}
+
+/**
+ * Checks whether regular fonts are selected per code point, rather than the
+ * first regular font being used for every code point.
+ */
+static SDL_bool font_has_choice(font_ctx_s *ctx)
+{
+#ifndef NO_UNIFONT
+	/* Unifont is only of use if it can be opened. */
+	if(SDL_AtomicGet(&ctx->unifont_failed) == 0)
+		return SDL_TRUE;
+#endif
+
+	return SDL_AtomicGet(&ctx->regular_count) > 1 || ctx->index != NULL ?
+		SDL_TRUE : SDL_FALSE;
+}
+
+/**
+ * Records the code points provided by a regular font from its character map,
+ * which is much faster than probing the font for each code point.
+ *
+ * \param i	Index of the regular font.
+ * \param f	Opened instance of the font, which is probed if the character
+ *		map cannot be read. May be NULL.
+ * \return	Bitmap of FONT_COVERAGE_CP bits, or NULL on error.
+ */
+static Uint8 *font_read_coverage(const font_ctx_s *ctx, unsigned i,
+	TTF_Font *f)
+{
+	const char *loc = ctx->regular_path[i];
+	SDL_RWops *rw;
+	Uint8 *map;
+	int ret = -1;
+
+	map = SDL_calloc(FONT_COVERAGE_CP / 8, 1);
+	if(map == NULL)
+		return NULL;
+
+	if(loc != NULL)
+		rw = font_map_file(loc);
+	else
+		rw = SDL_RWFromConstMem(NotoSansDisplay_Regular_Latin_ttf,
+			NotoSansDisplay_Regular_Latin_ttf_len);
+
+	if(rw != NULL)
+	{
+		ret = font_index_read_coverage(rw, map, FONT_COVERAGE_CP / 8);
+		SDL_RWclose(rw);
+	}
+
+	if(ret == 0)
+		return map;
+
+	if(f == NULL)
+	{
+		SDL_free(map);
+		return NULL;
+	}
+
+	for(Uint32 cp = 0; cp < FONT_COVERAGE_CP; cp++)
+	{
+		if(TTF_GlyphIsProvided32(f, cp) != 0)
+			map[cp / 8] |= (Uint8)(1 << (cp % 8));
+	}
+
+	return map;
+}
+
+/**
+ * Opens a regular font that was discovered after the set was opened.
+ *
+ * \return	0 on success, or -1 if the font cannot be opened.
+ */
+static int font_open_regular(font_ctx_s *ctx, struct font_set *set,
+	unsigned i)
+{
+	const char *loc;
+	TTF_Font *f;
+
+	if(i == FONT_FALLBACK)
+	{
+#ifndef NO_UNIFONT
+		if(set->worker == SDL_TRUE ||
+			SDL_AtomicGet(&ctx->unifont_failed) != 0)
+			return -1;
+
+		SDL_LockMutex(ctx->open_lock);
+		ctx->unifont = font_open_mem(unifont_woff2,
+			unifont_woff2_len);
+		SDL_UnlockMutex(ctx->open_lock);
+
+		if(ctx->unifont == NULL)
+		{
+			SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_FONT,
+				"Unable to open Unifont: %s", SDL_GetError());
+			SDL_AtomicSet(&ctx->unifont_failed, 1);
+			return -1;
+		}
+
+		/* The size is set by font_regular(). */
+		SDL_zero(ctx->unifont_size);
+		return 0;
+#else
+		return -1;
+#endif
+	}
+
+	if((set->regular_failed & (1u << i)) != 0)
+		return -1;
+
+	loc = ctx->regular_path[i];
+	if(loc == NULL)
+		return -1;
+
+	SDL_LockMutex(ctx->open_lock);
+	f = font_open_file(loc);
+	SDL_UnlockMutex(ctx->open_lock);
+
+	if(f == NULL)
+	{
+		SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_FONT,
+			"Unable to open font '%s': %s", loc, SDL_GetError());
+		set->regular_failed |= 1u << i;
+		return -1;
+	}
+
+	/* Fonts are set to the size of the set, if it has been set. */
+	if(set->size.vdpi != 0)
+	{
+		TTF_SetFontSizeDPI(f, set->size.pt[FONT_STYLE_REGULAR],
+			set->size.hdpi, set->size.vdpi);
+	}
+
+	set->ui_regular[i] = f;
+	return 0;
+}
+
+/**
+ * Obtains an opened regular font of a set. The fallback font is shared by the
+ * sets of the render thread, so it is set to the size of the given set if it
+ * was last used by a set of another size.
+ *
+ * \return	Font, or NULL if the font is not opened in the set.
+ */
+static TTF_Font *font_regular(font_ctx_s *ctx, struct font_set *set,
+	unsigned i)
+{
+	if(i != FONT_FALLBACK)
+		return set->ui_regular[i];
+
+#ifndef NO_UNIFONT
+	if(set->worker == SDL_TRUE || ctx->unifont == NULL)
+		return NULL;
+
+	if(set->size.vdpi != 0 && SDL_memcmp(&ctx->unifont_size, &set->size,
+		sizeof(set->size)) != 0)
+	{
+		TTF_SetFontSizeDPI(ctx->unifont,
+			set->size.pt[FONT_STYLE_REGULAR], set->size.hdpi,
+			set->size.vdpi);
+		ctx->unifont_size = set->size;
+	}
+
+	return ctx->unifont;
+#else
+	(void)ctx;
+	return NULL;
+#endif
+}
+
+/**
+ * Checks whether a regular font provides a glyph for a code point. The font is
+ * opened if it provides the code point and it is not yet opened in the set.
+ */
+static SDL_bool font_provides(font_ctx_s *ctx, struct font_set *set,
+	unsigned i, Uint32 cp)
+{
+	const Uint8 *map = ctx->coverage[i];
+	const SDL_bool mapped = map != NULL && cp < FONT_COVERAGE_CP;
+	TTF_Font *f;
+
+	if(mapped == SDL_TRUE && ((map[cp / 8] >> (cp % 8)) & 1) == 0)
+		return SDL_FALSE;
+
+	f = font_regular(ctx, set, i);
+	if(f == NULL)
+	{
+		if(font_open_regular(ctx, set, i) != 0)
+			return SDL_FALSE;
+
+		f = font_regular(ctx, set, i);
+	}
+
+	if(mapped == SDL_TRUE)
+		return SDL_TRUE;
+
+	return TTF_GlyphIsProvided32(f, cp) != 0 ? SDL_TRUE : SDL_FALSE;
+}
+
+/**
+ * Adds an installed font that provides a code point to the regular fonts. May
+ * be called from any thread.
+ */
+static void font_discover(font_ctx_s *ctx, Uint32 cp)
+{
+	const char *loc;
+	unsigned count;
+
+	SDL_LockMutex(ctx->open_lock);
+
+	count = (unsigned)SDL_AtomicGet(&ctx->regular_count);
+	if(count >= MAX_FONTS)
+		goto out;
+
+	loc = font_index_find(ctx->index, cp);
+	if(loc == NULL)
+		goto out;
+
+	ctx->regular_path[count] = SDL_strdup(loc);
+	if(ctx->regular_path[count] == NULL)
+		goto out;
+
+	/* If the coverage cannot be read, the font is probed instead. */
+	ctx->coverage[count] = font_read_coverage(ctx, count, NULL);
+	SDL_AtomicSet(&ctx->regular_count, (int)count + 1);
+
+out:
+	SDL_UnlockMutex(ctx->open_lock);
+}
+
+/**
+ * Selects the regular font used to render a code point. If no regular font
+ * provides the code point, a suitable installed font is added.
+ *
+ * \return	Index of the first regular font that provides the code point,
+ *		or zero if no font provides it.
+ */
+static unsigned font_select_regular(font_ctx_s *ctx, struct font_set *set,
+	Uint32 cp)
+{
+	unsigned count = (unsigned)SDL_AtomicGet(&ctx->regular_count);
+	unsigned i = 0;
+
+	/* Regular fonts are loaded in order, so if only the first font is
+	 * available then it is used for every code point. */
+	if(font_has_choice(ctx) == SDL_FALSE)
+		return 0;
+
+	for(;;)
+	{
+		unsigned next;
+
+		for(; i < count; i++)
+		{
+			/* It is possible that the font is not available
+			 * on the running platform. */
+			if(font_provides(ctx, set, i, cp) == SDL_TRUE)
+				return i;
+		}
+
+		if(ctx->index == NULL)
+			break;
+
+		/* Fonts added by other threads are also checked. */
+		font_discover(ctx, cp);
+		next = (unsigned)SDL_AtomicGet(&ctx->regular_count);
+		if(next == count)
+			break;
+
+		count = next;
+	}
+
+#ifndef NO_UNIFONT
+	/* Unifont provides almost every code point of the Basic Multilingual
+	 * Plane, and none beyond it. It is only opened once no other font
+	 * provides a code point. */
+	if(cp < 0x10000 &&
+		font_provides(ctx, set, FONT_FALLBACK, cp) == SDL_TRUE)
+		return FONT_FALLBACK;
+#endif
+
+	/* Select any available font if unable to select a suitable one. */
+	return 0;
+}
+
+/**
+ * Selects the font used to render text of the given style.
+ *
+ * \param cp	Code point that the font should provide. Only used to select
+ *		between regular fonts.
+ * \return	Font, or NULL if no font is available.
+ */
+static TTF_Font *font_select(font_ctx_s *ctx, struct font_set *set,
+	font_style_e s, Uint32 cp)
+{
+	switch(s)
+	{
+	case FONT_STYLE_HEADER:
+		return set->ui_header;
+
+	case FONT_STYLE_ICON:
+		return set->ui_icons;
+
+	case FONT_STYLE_REGULAR:
+	default:
+		break;
+	}
+
+	return font_regular(ctx, set, font_select_regular(ctx, set, cp));
+}
+
+/**
+ * Whether the code point belongs to a script that is written right to left,
+ * and so requires the string to be reordered before it is drawn.
+ */
+static SDL_bool font_is_rtl(Uint32 cp)
+{
+	return (cp >= 0x0590 && cp <= 0x08FF) ||
+		(cp >= 0xFB1D && cp <= 0xFDFF) ||
+		(cp >= 0xFE70 && cp <= 0xFEFF) ||
+		(cp >= 0x10800 && cp <= 0x10FFF) ||
+		(cp >= 0x1E800 && cp <= 0x1EFFF) ? SDL_TRUE : SDL_FALSE;
+}
+
+/**
+ * Checks whether a string contains right-to-left text, and so must be
+ * reordered before it is drawn. ASCII characters are skipped without being
+ * decoded.
+ */
+static SDL_bool font_needs_bidi(const char *str)
+{
+	const char *p = str;
+
+	while(*p != '\0')
+	{
+		if((unsigned char)*p < 0x80)
+		{
+			p++;
+			continue;
+		}
+
+		if(font_is_rtl(font_utf8_next(&p)) == SDL_TRUE)
+			return SDL_TRUE;
+	}
+
+	return SDL_FALSE;
+}
+
+#ifndef NO_FRIBIDI
+/**
+ * Obtains the visual order of a string that contains right-to-left text. The
+ * result is kept, so that the string is not reordered again when it is next
+ * rendered.
+ *
+ * \param b	Bidirectional state of the calling thread.
+ * \param str	UTF-8 string in logical order.
+ * \return	UTF-8 string in visual order, which is owned by b, or NULL on
+ *		error.
+ */
+static const char *font_bidi_reorder(struct font_bidi *b, const char *str)
+{
+	const size_t len = SDL_strlen(str);
+	const Uint64 hash = wyhash64(str, len, 0);
+	const unsigned slot = (unsigned)hash & (FONT_BIDI_CACHE_SLOTS - 1);
+	FriBidiParType biditype = FRIBIDI_PAR_ON;
+	FriBidiStrIndex cp_len;
+	char *utf8;
+
+	if(b->cache[slot].utf8 != NULL && b->cache[slot].hash == hash)
+		return b->cache[slot].utf8;
+
+	/* A UTF-8 string has no more code points than bytes. */
+	stb_arr_setlen(b->logical, (int)len + 1);
+	stb_arr_setlen(b->visual, (int)len + 1);
+
+	cp_len = fribidi_charset_to_unicode(FRIBIDI_CHAR_SET_UTF8, str,
+		(FriBidiStrIndex)len, b->logical);
+	if(fribidi_log2vis(b->logical, cp_len, &biditype, b->visual,
+			NULL, NULL, NULL) == 0)
+		return NULL;
+
+	/* Shaping may replace characters with presentation forms that have
+	 * longer encodings, so allow for the longest encoding. */
+	utf8 = SDL_malloc((size_t)cp_len * 4 + 1);
+	if(utf8 == NULL)
+		return NULL;
+
+	fribidi_unicode_to_charset(FRIBIDI_CHAR_SET_UTF8, b->visual, cp_len,
+		utf8);
+
+	SDL_free(b->cache[slot].utf8);
+	b->cache[slot].hash = hash;
+	b->cache[slot].utf8 = utf8;
+
+	return utf8;
+}
+
+static void font_bidi_free(struct font_bidi *b)
+{
+	for(unsigned i = 0; i < FONT_BIDI_CACHE_SLOTS; i++)
+	{
+		SDL_free(b->cache[i].utf8);
+		b->cache[i].utf8 = NULL;
+	}
+
+	stb_arr_free(b->logical);
+	stb_arr_free(b->visual);
+	b->logical = NULL;
+	b->visual = NULL;
+}
+#endif
+
+/**
+ * Removes all glyphs from an atlas, so that it may be reused.
+ */
+static void glyph_atlas_reset(struct glyph_atlas *ga)
+{
+	if(ga->glyphs != NULL)
+	{
+		SDL_memset(ga->glyphs, 0,
+			(ga->glyph_mask + 1) * sizeof(*ga->glyphs));
+	}
+
+	ga->glyph_count = 0;
+	ga->x = 0;
+	ga->y = 0;
+	ga->row_h = 0;
+}
+
+/**
+ * Destroys the texture of an atlas and frees its glyph table.
+ */
+static void glyph_atlas_free(struct glyph_atlas *ga)
+{
+	if(ga->tex != NULL)
+		SDL_DestroyTexture(ga->tex);
+
+	SDL_free(ga->glyphs);
+	SDL_zerop(ga);
+}
+
+static Uint32 glyph_find(const struct glyph_atlas *ga, Uint32 cp)
+{
+	/* Fibonacci hashing spreads consecutive code points. */
+	Uint32 slot = (cp * 0x9E3779B9u) >> 7;
+
+	slot &= ga->glyph_mask;
+	while(ga->glyphs[slot].cp != 0 && ga->glyphs[slot].cp != cp)
+		slot = (slot + 1) & ga->glyph_mask;
+
+	return slot;
+}
+
+/**
+ * Grows the glyph table so that it is at most half full after a glyph is
+ * added.
+ *
+ * \return	0 on success, or -1 if out of memory.
+ */
+static int glyph_table_reserve(struct glyph_atlas *ga)
+{
+	struct font_glyph *old = ga->glyphs;
+	Uint32 old_slots = old == NULL ? 0 : ga->glyph_mask + 1;
+	Uint32 slots;
+
+	if(old != NULL && ga->glyph_count + 1 <= ga->glyph_mask / 2)
+		return 0;
+
+	slots = old == NULL ? GLYPH_TABLE_MIN_SLOTS : old_slots * 2;
+	ga->glyphs = SDL_calloc(slots, sizeof(*ga->glyphs));
+	if(ga->glyphs == NULL)
+	{
+		ga->glyphs = old;
+		return -1;
+	}
+
+	ga->glyph_mask = slots - 1;
+	for(Uint32 i = 0; i < old_slots; i++)
+	{
+		if(old[i].cp != 0)
+			ga->glyphs[glyph_find(ga, old[i].cp)] = old[i];
+	}
+
+	SDL_free(old);
+	return 0;
+}
+
+/**
+ * Allocates space for a glyph bitmap within the atlas, placing glyphs in rows
+ * from left to right.
+ *
+ * \return	SDL_TRUE if space was allocated.
+ */
+static SDL_bool glyph_atlas_alloc(struct glyph_atlas *ga, int w, int h,
+	SDL_Rect *r)
+{
+	w += GLYPH_ATLAS_PADDING;
+	h += GLYPH_ATLAS_PADDING;
+
+	if(ga->x + w > ga->w)
+	{
+		ga->x = 0;
+		ga->y += ga->row_h;
+		ga->row_h = 0;
+	}
+
+	if(w > ga->w || ga->y + h > ga->h)
+		return SDL_FALSE;
+
+	r->x = ga->x;
+	r->y = ga->y;
+	r->w = w - GLYPH_ATLAS_PADDING;
+	r->h = h - GLYPH_ATLAS_PADDING;
+	ga->x += w;
+	ga->row_h = SDL_max(ga->row_h, h);
+	return SDL_TRUE;
+}
+
+/**
+ * Obtains the fonts that glyphs in the atlases are rasterised with.
+ */
+static struct font_set *font_atlas_set(font_ctx_s *ctx)
+{
+	return ctx->scaled == SDL_TRUE ? &ctx->scaled_fonts : &ctx->fonts;
+}
+
+/**
+ * Obtains the factors that glyphs in the atlases are scaled by when drawn.
+ */
+static void font_atlas_scale(const font_ctx_s *ctx, float *sx, float *sy)
+{
+	if(ctx->scaled == SDL_FALSE)
+	{
+		*sx = 1.0f;
+		*sy = 1.0f;
+		return;
+	}
+
+	*sx = (float)ctx->fonts.size.hdpi / (float)GLYPH_SCALED_REF_DPI;
+	*sy = (float)ctx->fonts.size.vdpi / (float)GLYPH_SCALED_REF_DPI;
+}
+
+/**
+ * Creates the texture of an atlas if it has not been created yet, or if it
+ * was created at a different size. The size is limited to that supported by
+ * the renderer.
+ *
+ * \return	0 on success, or -1 on error.
+ */
+static int glyph_atlas_create(font_ctx_s *ctx, struct glyph_atlas *ga,
+	int w, int h)
+{
+	w = SDL_min(w, ctx->tex_min_w);
+	h = SDL_min(h, ctx->tex_min_h);
+	if(ga->tex != NULL && ga->w == w && ga->h == h)
+		return 0;
+
+	if(ga->tex != NULL)
+		SDL_DestroyTexture(ga->tex);
+
+	ga->w = w;
+	ga->h = h;
+	ga->tex = SDL_CreateTexture(ctx->rend, SDL_PIXELFORMAT_ARGB8888,
+		SDL_TEXTUREACCESS_STATIC, ga->w, ga->h);
+	if(ga->tex == NULL)
+		return -1;
+
+	SDL_SetTextureBlendMode(ga->tex, SDL_BLENDMODE_BLEND);
+#if SDL_VERSION_ATLEAST(2, 0, 12)
+	if(ctx->scaled == SDL_TRUE)
+		SDL_SetTextureScaleMode(ga->tex, SDL_ScaleModeLinear);
+#endif
+
+	return 0;
+}
+
+/**
+ * Rasterises a glyph in white, to be placed within the atlas of the given
+ * style.
+ *
+ * \param g	Set to the glyph, except for its location within the atlas.
+ * \return	Bitmap of the glyph, or NULL on error.
+ */
+static SDL_Surface *font_rasterise_glyph(font_ctx_s *ctx, font_style_e s,
+	Uint32 cp, struct font_glyph *g)
+{
+	const SDL_Colour white = { 0xFF, 0xFF, 0xFF, SDL_ALPHA_OPAQUE };
+	SDL_Surface *surf, *conv;
+	int minx, maxx, miny, maxy;
+
+	g->cp = cp;
+	g->font = font_select(ctx, font_atlas_set(ctx), s, cp);
+	if(g->font == NULL ||
+		TTF_GlyphMetrics32(g->font, cp, &minx, &maxx, &miny, &maxy,
+			&g->advance) != 0)
+		return NULL;
+
+	surf = TTF_RenderGlyph32_Blended(g->font, cp, white);
+	if(surf == NULL)
+		return NULL;
+
+	conv = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_ARGB8888, 0);
+	SDL_FreeSurface(surf);
+
+	/* Glyphs that extend to the left of the pen are rendered with their
+	 * left edge at the start of the bitmap. */
+	g->offset_x = SDL_min(minx, 0);
+	return conv;
+}
+
+/**
+ * Adds a glyph whose bitmap is already within the atlas to its table.
+ */
+static void glyph_atlas_insert(struct glyph_atlas *ga,
+	const struct font_glyph *g)
+{
+	if(glyph_table_reserve(ga) != 0)
+		return;
+
+	ga->glyphs[glyph_find(ga, g->cp)] = *g;
+	ga->glyph_count++;
+}
+
+/**
+ * Looks up a glyph within the table of an atlas.
+ *
+ * \param glyph	Set to a copy of the glyph if found.
+ * \return	SDL_TRUE if the glyph is within the atlas.
+ */
+static SDL_bool glyph_atlas_lookup(const struct glyph_atlas *ga, Uint32 cp,
+	struct font_glyph *glyph)
+{
+	Uint32 slot;
+
+	if(ga->glyphs == NULL)
+		return SDL_FALSE;
+
+	slot = glyph_find(ga, cp);
+	if(ga->glyphs[slot].cp != cp)
+		return SDL_FALSE;
+
+	*glyph = ga->glyphs[slot];
+	return SDL_TRUE;
+}
+
+/**
+ * Obtains a glyph from the atlas of the given style, rendering it into the
+ * atlas if it is not already present.
+ *
+ * \param glyph	Set to a copy of the glyph.
+ * \return	Atlas whose texture holds the glyph, or NULL on error.
+ */
+static struct glyph_atlas *font_get_glyph(font_ctx_s *ctx, font_style_e s,
+	Uint32 cp, struct font_glyph *glyph)
+{
+	struct font_set *set = font_atlas_set(ctx);
+	struct glyph_atlas *ga = &set->atlas[s];
+	SDL_Surface *conv;
+	struct font_glyph g;
+
+	if(glyph_atlas_lookup(ga, cp, glyph) == SDL_TRUE)
+		return ga;
+
+	/* Icons not set by font_set_icons() are kept in an atlas of their
+	 * own, so that clearing it never removes the icons that were. */
+	if(s == FONT_STYLE_ICON)
+	{
+		ga = &set->icon_overflow;
+		if(glyph_atlas_lookup(ga, cp, glyph) == SDL_TRUE)
+			return ga;
+	}
+
+	if(glyph_atlas_create(ctx, ga, GLYPH_ATLAS_SIZE,
+		GLYPH_ATLAS_SIZE) != 0)
+		return NULL;
+
+	conv = font_rasterise_glyph(ctx, s, cp, &g);
+	if(conv == NULL)
+		return NULL;
+
+	/* The atlas is cleared once it is full. Any glyphs already drawn from
+	 * it are flushed by SDL before the texture is updated. */
+	if(glyph_atlas_alloc(ga, conv->w, conv->h, &g.src) == SDL_FALSE)
+	{
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+			"Glyph atlas of style %d is full; clearing", s);
+		glyph_atlas_reset(ga);
+		if(glyph_atlas_alloc(ga, conv->w, conv->h, &g.src) == SDL_FALSE)
+		{
+			SDL_FreeSurface(conv);
+			return NULL;
+		}
+	}
+
+	SDL_UpdateTexture(ga->tex, &g.src, conv->pixels, conv->pitch);
+	SDL_FreeSurface(conv);
+	glyph_atlas_insert(ga, &g);
+
+	*glyph = g;
+	return ga;
+}
+
+/**
+ * Finds the size of atlas required to hold the given bitmaps, placed in
+ * order. The size starts at that of other atlases and is doubled, one side
+ * at a time, up to the largest texture supported by the renderer.
+ *
+ * \return	SDL_TRUE if all bitmaps fit, or SDL_FALSE if the largest size
+ *		does not hold them all.
+ */
+static SDL_bool glyph_atlas_fit(const font_ctx_s *ctx,
+	SDL_Surface *const *surfs, int n, int *w, int *h)
+{
+	*w = SDL_min(GLYPH_ATLAS_SIZE, ctx->tex_min_w);
+	*h = SDL_min(GLYPH_ATLAS_SIZE, ctx->tex_min_h);
+
+	for(;;)
+	{
+		struct glyph_atlas trial = { 0 };
+		SDL_Rect r;
+		int i;
+
+		trial.w = *w;
+		trial.h = *h;
+		for(i = 0; i < n; i++)
+		{
+			if(glyph_atlas_alloc(&trial, surfs[i]->w, surfs[i]->h,
+				&r) == SDL_FALSE)
+				break;
+		}
+
+		if(i == n)
+			return SDL_TRUE;
+
+		if(*w <= *h && *w < ctx->tex_min_w)
+			*w = SDL_min(*w * 2, ctx->tex_min_w);
+		else if(*h < ctx->tex_min_h)
+			*h = SDL_min(*h * 2, ctx->tex_min_h);
+		else if(*w < ctx->tex_min_w)
+			*w = SDL_min(*w * 2, ctx->tex_min_w);
+		else
+			return SDL_FALSE;
+	}
+}
+
+/**
+ * Empties the icon atlas of the fonts that glyphs are rasterised with, and
+ * rasterises the icons set by font_set_icons() into it. The atlas is sized to
+ * hold all of the icons where the renderer permits, and the icons are
+ * composed in a single bitmap that is uploaded to the atlas at once. Icons
+ * drawn that are not within the atlas are placed in a separate atlas, so that
+ * these remain resident.
+ */
+static void font_rasterise_icons(font_ctx_s *ctx)
+{
+	struct font_set *set = font_atlas_set(ctx);
+	struct glyph_atlas *ga = &set->atlas[FONT_STYLE_ICON];
+	const Uint32 start_ms = SDL_GetTicks();
+	SDL_Surface **surfs = NULL;
+	struct font_glyph *glyphs = NULL;
+	SDL_Surface *batch = NULL;
+	SDL_Rect rows;
+	unsigned done = 0;
+	int w, h;
+
+	glyph_atlas_reset(ga);
+	glyph_atlas_reset(&set->icon_overflow);
+	set->icons_ready = SDL_TRUE;
+	if(stb_arr_len(ctx->icons) == 0)
+		return;
+
+	for(int i = 0; i < stb_arr_len(ctx->icons); i++)
+	{
+		SDL_Surface *conv;
+		struct font_glyph g;
+
+		conv = font_rasterise_glyph(ctx, FONT_STYLE_ICON,
+			ctx->icons[i], &g);
+		if(conv == NULL)
+			continue;
+
+		stb_arr_push(surfs, conv);
+		stb_arr_push(glyphs, g);
+	}
+
+	if(glyph_atlas_fit(ctx, surfs, stb_arr_len(surfs), &w, &h) ==
+		SDL_FALSE)
+	{
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+			"Not all icons fit within a %dx%d atlas", w, h);
+	}
+
+	if(glyph_atlas_create(ctx, ga, w, h) != 0)
+		goto err;
+
+	batch = SDL_CreateRGBSurfaceWithFormat(0, ga->w, ga->h, 32,
+		SDL_PIXELFORMAT_ARGB8888);
+	if(batch == NULL)
+		goto err;
+
+	for(int i = 0; i < stb_arr_len(surfs); i++)
+	{
+		struct font_glyph *g = &glyphs[i];
+		SDL_Rect dst;
+
+		/* Icons that do not fit are rasterised when drawn. */
+		if(glyph_atlas_alloc(ga, surfs[i]->w, surfs[i]->h,
+			&g->src) == SDL_FALSE)
+			break;
+
+		/* The bitmap is copied as is, rather than blended. */
+		dst = g->src;
+		SDL_SetSurfaceBlendMode(surfs[i], SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(surfs[i], NULL, batch, &dst);
+
+		glyph_atlas_insert(ga, g);
+		done++;
+	}
+
+	rows.x = 0;
+	rows.y = 0;
+	rows.w = ga->w;
+	rows.h = SDL_min(ga->y + ga->row_h, ga->h);
+	if(rows.h > 0)
+		SDL_UpdateTexture(ga->tex, &rows, batch->pixels, batch->pitch);
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+		"Rasterised %u of %d icons into a %dx%d atlas in %u ms", done,
+		stb_arr_len(ctx->icons), ga->w, ga->h,
+		SDL_GetTicks() - start_ms);
+	goto out;
+
+err:
+	SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_FONT,
+		"Unable to rasterise icons: %s", SDL_GetError());
+
+out:
+	SDL_FreeSurface(batch);
+	for(int i = 0; i < stb_arr_len(surfs); i++)
+		SDL_FreeSurface(surfs[i]);
+
+	stb_arr_free(surfs);
+	stb_arr_free(glyphs);
+}
+
+void font_set_icons(font_ctx_s *ctx, const Uint16 *icons, size_t n)
+{
+	SDL_assert(ctx != NULL);
+	SDL_assert(icons != NULL || n == 0);
+
+	stb_arr_setlen(ctx->icons, 0);
+	for(size_t i = 0; i < n; i++)
+	{
+		SDL_bool dup = SDL_FALSE;
+
+		for(int j = 0; j < stb_arr_len(ctx->icons); j++)
+		{
+			if(ctx->icons[j] == icons[i])
+			{
+				dup = SDL_TRUE;
+				break;
+			}
+		}
+
+		/* Zero marks an empty slot within the glyph table. */
+		if(dup == SDL_FALSE && icons[i] != 0)
+			stb_arr_push(ctx->icons, icons[i]);
+	}
+
+	/* Sets other than the one in use are rasterised when next used. */
+	ctx->fonts.icons_ready = SDL_FALSE;
+	ctx->scaled_fonts.icons_ready = SDL_FALSE;
+	for(unsigned i = 0; i < FONT_POOL_SIZE; i++)
+		ctx->pool[i].icons_ready = SDL_FALSE;
+
+	font_rasterise_icons(ctx);
+}
+
+int font_draw_text(font_ctx_s *ctx, const char *str, font_style_e s,
+	SDL_Colour fg, int x, int y, SDL_Rect *dim)
+{
+	struct font_glyph prev = { 0 };
+	const char *p;
+	float pen_x = (float)x;
+	float sx, sy;
+	int h;
+
+	SDL_assert(ctx != NULL);
+	SDL_assert(str != NULL);
+
+	/* Strings that require reordering are rendered with
+	 * font_render_text(). */
+	if(font_needs_bidi(str) == SDL_TRUE)
+		return -1;
+
+	h = font_get_height(ctx, s);
+	font_atlas_scale(ctx, &sx, &sy);
+
+	for(p = str; *p != '\0';)
+	{
+		Uint32 cp = font_utf8_next(&p);
+		struct glyph_atlas *ga;
+		struct font_glyph g;
+		SDL_Rect dst;
+
+		ga = font_get_glyph(ctx, s, cp, &g);
+		if(ga == NULL)
+			continue;
+
+		if(prev.cp != 0 && prev.font == g.font)
+			pen_x += sx * (float)TTF_GetFontKerningSizeGlyphs32(
+				g.font, prev.cp, cp);
+
+		dst.x = (int)(pen_x + sx * (float)g.offset_x);
+		dst.y = y;
+		dst.w = (int)SDL_ceilf(sx * (float)g.src.w);
+		dst.h = (int)SDL_ceilf(sy * (float)g.src.h);
+		h = SDL_max(h, dst.h);
+
+		/* The tint is set for each glyph, as the texture may have been
+		 * created whilst drawing this string. */
+		SDL_SetTextureColorMod(ga->tex, fg.r, fg.g, fg.b);
+		SDL_SetTextureAlphaMod(ga->tex, fg.a);
+		SDL_RenderCopy(ctx->rend, ga->tex, &g.src, &dst);
+
+		pen_x += sx * (float)g.advance;
+		prev = g;
+	}
+
+	if(dim != NULL)
+	{
+		dim->x = x;
+		dim->y = y;
+		dim->w = (int)SDL_ceilf(pen_x) - x;
+		dim->h = h;
+	}
+
+	return 0;
+}
+
+int font_draw_icon(font_ctx_s *ctx, Uint16 icon, SDL_Colour fg,
+	const SDL_Rect *area)
+{
+	struct glyph_atlas *ga;
+	struct font_glyph g;
+	float sx, sy, w, h, fit;
+	SDL_Rect dst;
+
+	SDL_assert(ctx != NULL);
+	SDL_assert(area != NULL);
+
+	ga = font_get_glyph(ctx, FONT_STYLE_ICON, icon, &g);
+	if(ga == NULL)
+		return -1;
+
+	font_atlas_scale(ctx, &sx, &sy);
+	w = sx * (float)g.src.w;
+	h = sy * (float)g.src.h;
+
+	/* Shrink the icon to fit within the area if required. */
+	fit = SDL_min((float)area->w / w, (float)area->h / h);
+	if(fit < 1.0f)
+	{
+		w *= fit;
+		h *= fit;
+	}
+
+	dst.w = (int)w;
+	dst.h = (int)h;
+	dst.x = area->x + (area->w - dst.w) / 2;
+	dst.y = area->y + (area->h - dst.h) / 2;
+
+	SDL_SetTextureColorMod(ga->tex, fg.r, fg.g, fg.b);
+	SDL_SetTextureAlphaMod(ga->tex, fg.a);
+	return SDL_RenderCopy(ctx->rend, ga->tex, &g.src, &dst);
+}
+
+static void font_metrics_reset(struct font_metrics *m)
+{
+	SDL_memset(m->ascii, 0, sizeof(m->ascii));
+	SDL_memset(m->kern, (Uint8)FONT_KERN_UNKNOWN, sizeof(m->kern));
+
+	if(m->table != NULL)
+		SDL_memset(m->table, 0, (m->mask + 1) * sizeof(*m->table));
+
+	m->count = 0;
+}
+
+static Uint32 font_metrics_find(const struct font_metrics *m, Uint32 cp)
+{
+	Uint32 slot = ((cp * 0x9E3779B9u) >> 7) & m->mask;
+
+	while(m->table[slot].cp != 0 && m->table[slot].cp != cp)
+		slot = (slot + 1) & m->mask;
+
+	return slot;
+}
+
+/**
+ * Grows the table of advances so that it is at most half full after an
+ * advance is added.
+ *
+ * \return	0 on success, or -1 if out of memory.
+ */
+static int font_metrics_reserve(struct font_metrics *m)
+{
+	struct font_advance *old = m->table;
+	Uint32 old_slots = old == NULL ? 0 : m->mask + 1;
+	Uint32 slots;
+
+	if(old != NULL && m->count + 1 <= m->mask / 2)
+		return 0;
+
+	slots = old == NULL ? GLYPH_TABLE_MIN_SLOTS : old_slots * 2;
+	m->table = SDL_calloc(slots, sizeof(*m->table));
+	if(m->table == NULL)
+	{
+		m->table = old;
+		return -1;
+	}
+
+	m->mask = slots - 1;
+	for(Uint32 i = 0; i < old_slots; i++)
+	{
+		if(old[i].cp != 0)
+			m->table[font_metrics_find(m, old[i].cp)] = old[i];
+	}
+
+	SDL_free(old);
+	return 0;
+}
+
+/**
+ * Obtains the advance of a code point, which is cached after it is first
+ * obtained.
+ *
+ * \return	Advance, or NULL on error. Only valid until the next call.
+ */
+static const struct font_advance *font_get_advance(font_ctx_s *ctx,
+	font_style_e s, Uint32 cp)
+{
+	struct font_metrics *m = &ctx->fonts.metrics[s];
+	struct font_advance *a;
+	TTF_Font *font;
+	int advance;
+
+	if(cp < FONT_METRICS_ASCII)
+	{
+		a = &m->ascii[cp];
+		if(a->font != NULL)
+			return a;
+	}
+	else
+	{
+		if(m->table != NULL)
+		{
+			a = &m->table[font_metrics_find(m, cp)];
+			if(a->cp == cp)
+				return a;
+		}
+
+		if(font_metrics_reserve(m) != 0)
+			return NULL;
+
+		a = &m->table[font_metrics_find(m, cp)];
+	}
+
+	font = font_select(ctx, &ctx->fonts, s, cp);
+	if(font == NULL)
+		return NULL;
+
+	/* Glyphs that the font does not provide are rendered as the missing
+	 * glyph, which this obtains the advance of. */
+	if(TTF_GlyphMetrics32(font, cp, NULL, NULL, NULL, NULL, &advance) != 0)
+		advance = 0;
+
+	if(cp >= FONT_METRICS_ASCII)
+		m->count++;
+
+	a->cp = cp;
+	a->font = font;
+	a->advance = advance;
+	return a;
+}
+
+/**
+ * Obtains the kerning between two code points rendered by the same font.
+ */
+static int font_get_kerning(font_ctx_s *ctx, font_style_e s, TTF_Font *font,
+	Uint32 prev_cp, Uint32 cp)
+{
+	Sint8 *k;
+	int kern;
+
+	if(prev_cp >= FONT_METRICS_ASCII || cp >= FONT_METRICS_ASCII)
+		return TTF_GetFontKerningSizeGlyphs32(font, prev_cp, cp);
 
-SDL_Texture *font_render_icon(font_ctx_s *ctx, Uint16 icon, SDL_Colour fg)
+	k = &ctx->fonts.metrics[s].kern[prev_cp][cp];
+	if(*k != FONT_KERN_UNKNOWN)
+		return *k;
+
+	kern = TTF_GetFontKerningSizeGlyphs32(font, prev_cp, cp);
+	kern = SDL_max(SDL_min(kern, SDL_MAX_SINT8), FONT_KERN_UNKNOWN + 1);
+	*k = (Sint8)kern;
+	return kern;
+}
+
+int font_measure_text(font_ctx_s *ctx, const char *str, font_style_e s,
+	int *w, int *h)
+{
+	TTF_Font *prev_font = NULL;
+	Uint32 prev_cp = 0;
+	int width = 0, ascent = 0, descent = 0;
+
+	SDL_assert(ctx != NULL);
+	SDL_assert(str != NULL);
+	SDL_assert(s < FONT_STYLE_MAX);
+
+	for(const char *p = str; *p != '\0';)
+	{
+		const Uint32 cp = font_utf8_next(&p);
+		const struct font_advance *a = font_get_advance(ctx, s, cp);
+
+		if(a == NULL)
+			return -1;
+
+		/* Kerning is not applied between text of different fonts, as
+		 * each font renders its own run. */
+		if(a->font == prev_font)
+		{
+			width += font_get_kerning(ctx, s, a->font, prev_cp,
+				cp);
+		}
+		else
+		{
+			const int asc = TTF_FontAscent(a->font);
+
+			/* Runs of each font are joined along their
+			 * baselines. */
+			ascent = SDL_max(ascent, asc);
+			descent = SDL_max(descent,
+				TTF_FontHeight(a->font) - asc);
+			prev_font = a->font;
+		}
+
+		width += a->advance;
+		prev_cp = cp;
+	}
+
+	/* An empty string is the height of the first font. */
+	if(prev_font == NULL)
+	{
+		TTF_Font *font = s == FONT_STYLE_REGULAR ?
+			ctx->fonts.ui_regular[0] :
+			font_select(ctx, &ctx->fonts, s, 0);
+
+		if(font == NULL)
+			return -1;
+
+		ascent = TTF_FontHeight(font);
+	}
+
+	if(w != NULL)
+		*w = width;
+
+	if(h != NULL)
+		*h = ascent + descent;
+
+	return 0;
+}
+
+/**
+ * Renders an icon with the given set of fonts. May be called from any thread
+ * that owns the set.
+ */
+static SDL_Surface *font_render_icon_set(const font_ctx_s *ctx,
+	const struct font_set *set, Uint16 icon, SDL_Colour fg)
 {
 	SDL_Surface *surf;
-	SDL_Texture *tex = NULL;
 
-	surf = TTF_RenderGlyph_Blended(ctx->ui_icons, icon, fg);
+	surf = TTF_RenderGlyph_Blended(set->ui_icons, icon, fg);
 	if(surf == NULL)
 		goto out;
 
@@ -53,162 +1722,583 @@ SDL_Texture *font_render_icon(font_ctx_s *ctx, Uint16 icon, SDL_Colour fg)
 		SDL_LogError(HAIYAJAN_LOG_CATEGORY_FONT,
 			       "Icon size (%ux%u) exceeds maximum texture size (%ux%u).",
 			       surf->w, surf->h, ctx->tex_min_w, ctx->tex_min_h);
+		SDL_FreeSurface(surf);
+		surf = NULL;
 	}
+
+out:
+	return surf;
+}
+
+/**
+ * Renders regular text. The string is split into runs of code points that are
+ * provided by the same font, and the rendered runs are joined along their
+ * baselines.
+ */
+static SDL_Surface *font_render_runs(font_ctx_s *ctx,
+	struct font_set *set, const char *str,
+	SDL_Surface *(*render_fn)(TTF_Font *, const char *, SDL_Colour),
+	SDL_Colour fg)
+{
+	struct font_run
+	{
+		/* Index of the regular font. */
+		unsigned font;
+		/* Location of the run within str. */
+		size_t start, len;
+		SDL_Surface *surf;
+	} *runs = NULL;
+	SDL_Surface *ret = NULL;
+	char *buf = NULL;
+	int w = 0, ascent = 0, descent = 0;
+	unsigned count;
+
+	/* No choice of font. */
+	if(font_has_choice(ctx) == SDL_FALSE)
+		return render_fn(set->ui_regular[0], str, fg);
+
+	for(const char *p = str; *p != '\0';)
+	{
+		const size_t start = (size_t)(p - str);
+		const Uint32 cp = font_utf8_next(&p);
+		struct font_run run = { 0 };
+
+		if(stb_arr_len(runs) > 0)
+		{
+			struct font_run *last = &stb_arr_last(runs);
+
+			/* Code points such as spaces that are provided by the
+			 * font of the current run are kept within that run.
+			 * The fallback font provides almost every code point,
+			 * so only spaces are kept within its runs. */
+			if((font_provides(ctx, set, last->font, cp) ==
+					SDL_TRUE &&
+				(last->font != FONT_FALLBACK || cp == ' ')) ||
+				font_select_regular(ctx, set, cp) == last->font)
+			{
+				last->len = (size_t)(p - str) - last->start;
+				continue;
+			}
+		}
+
+		run.font = font_select_regular(ctx, set, cp);
+		run.start = start;
+		run.len = (size_t)(p - str) - start;
+		stb_arr_push(runs, run);
+	}
+
+	count = stb_arr_len(runs);
+	if(count <= 1)
+	{
+		ret = render_fn(font_regular(ctx, set,
+			count == 1 ? runs[0].font : 0), str, fg);
+		goto out;
+	}
+
+	/* Each run is terminated in place within a copy of the string. */
+	buf = SDL_strdup(str);
+	if(buf == NULL)
+		goto out;
+
+	for(unsigned i = 0; i < count; i++)
+	{
+		struct font_run *r = &runs[i];
+		TTF_Font *f = font_regular(ctx, set, r->font);
+		char *end = buf + r->start + r->len;
+		const char end_c = *end;
+		int asc;
+
+		*end = '\0';
+		r->surf = render_fn(f, buf + r->start, fg);
+		*end = end_c;
+		if(r->surf == NULL)
+			goto out;
+
+		asc = TTF_FontAscent(f);
+		w += r->surf->w;
+		ascent = SDL_max(ascent, asc);
+		descent = SDL_max(descent, r->surf->h - asc);
+	}
+
+	ret = SDL_CreateRGBSurfaceWithFormat(0, w, ascent + descent, 32,
+		SDL_PIXELFORMAT_ARGB8888);
+	if(ret == NULL)
+		goto out;
+
+	for(unsigned i = 0, x = 0; i < count; i++)
+	{
+		struct font_run *r = &runs[i];
+		SDL_Rect dst = {
+			.x = (int)x,
+			.y = ascent - TTF_FontAscent(font_regular(ctx, set,
+				r->font))
+		};
+
+		/* Copy the coverage of each glyph rather than blending it
+		 * with the transparent background. */
+		SDL_SetSurfaceBlendMode(r->surf, SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(r->surf, NULL, ret, &dst);
+		x += (unsigned)r->surf->w;
+	}
+
+out:
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(runs); i++)
+		SDL_FreeSurface(runs[i].surf);
+
+	stb_arr_free(runs);
+	SDL_free(buf);
+	return ret;
+}
+
+/**
+ * Obtains the distance that a code point advances the pen by, using the font
+ * that would render it.
+ */
+static int font_set_advance(font_ctx_s *ctx, struct font_set *set,
+	font_style_e s, Uint32 cp)
+{
+	TTF_Font *f = font_select(ctx, set, s, cp);
+	int adv;
+
+	if(f == NULL ||
+		TTF_GlyphMetrics32(f, cp, NULL, NULL, NULL, NULL, &adv) != 0)
+		return 0;
+
+	return adv;
+}
+
+/**
+ * Truncates a string that would be rendered wider than the given width or the
+ * largest texture, so that it ends with an ellipsis within that width. The
+ * width is measured from glyph advances, so that the string is only rendered
+ * once.
+ *
+ * \param font	Font of the style, used to estimate whether the string may be
+ *		too wide before it is measured.
+ * \param max_w	Width to truncate the string to, or 0 to only truncate it
+ *		to the largest texture.
+ * \return	Truncated copy of the string, which must be freed with
+ *		SDL_free(), or NULL if the string is not too wide or on error.
+ */
+static char *font_truncate_text(font_ctx_s *ctx, struct font_set *set,
+	font_style_e s, TTF_Font *font, const char *str, int max_w)
+{
+	const size_t len = SDL_strlen(str);
+	const char *ellipsis = FONT_ELLIPSIS;
+	const char *p, *cut = str;
+	size_t ellipsis_len = sizeof(FONT_ELLIPSIS);
+	int w = 0, ellipsis_w;
+	char *ret;
+
+	/* Leave room for kerning, and for glyphs that extend beyond their
+	 * advance, which are not measured. */
+	if(max_w <= 0 || max_w > ctx->tex_min_w - TTF_FontHeight(font))
+		max_w = ctx->tex_min_w - TTF_FontHeight(font);
+
+	/* Glyphs seldom advance further than twice the height of their font,
+	 * so most strings are too short to need measuring. */
+	if(len * 2 * (size_t)TTF_FontHeight(font) <= (size_t)max_w)
+		return NULL;
+
+	/* The bundled fonts do not provide an ellipsis. */
+	if(TTF_GlyphIsProvided32(font, FONT_ELLIPSIS_CP) != 0)
+		ellipsis_w = font_set_advance(ctx, set, s, FONT_ELLIPSIS_CP);
+	else
+	{
+		ellipsis = FONT_ELLIPSIS_ASCII;
+		ellipsis_len = sizeof(FONT_ELLIPSIS_ASCII);
+		ellipsis_w = font_set_advance(ctx, set, s, '.') * 3;
+	}
+
+	for(p = str; *p != '\0' && w <= max_w;)
+	{
+		const char *start = p;
+		const Uint32 cp = font_utf8_next(&p);
+
+		/* The string is cut after the last code point that fits
+		 * along with the ellipsis. */
+		if(w + ellipsis_w <= max_w)
+			cut = start;
+
+		w += font_set_advance(ctx, set, s, cp);
+	}
+
+	if(w <= max_w)
+		return NULL;
+
+	ret = SDL_malloc((size_t)(cut - str) + ellipsis_len);
+	if(ret == NULL)
+		return NULL;
+
+	SDL_memcpy(ret, str, (size_t)(cut - str));
+	SDL_memcpy(ret + (cut - str), ellipsis, ellipsis_len);
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+		"Truncated text of %u bytes to %u bytes to fit within %d "
+		"pixels", (unsigned)len, (unsigned)(cut - str), max_w);
+	return ret;
+}
+
+/**
+ * Renders text with the given set of fonts. May be called from any thread
+ * that owns the set.
+ */
+static SDL_Surface *font_render_text_set(font_ctx_s *ctx,
+	struct font_set *set, const char *str,
+	font_style_e s, font_quality_e q, SDL_Colour fg, int max_w)
+{
+	SDL_Surface *ret = NULL;
+	TTF_Font *font = NULL;
+	char *truncated = NULL;
+	SDL_Surface *(*TTF_Render_fn)(TTF_Font *, const char *, SDL_Colour);
+
+	SDL_assert(ctx != NULL);
+	SDL_assert(str != NULL);
+
+	/* Regular text may be rendered with several fonts, but the first
+	 * regular font is always available if any are. */
+	if(s == FONT_STYLE_REGULAR)
+		font = set->ui_regular[0];
+	else
+		font = font_select(ctx, set, s, 0);
+
+	/* If we still can't select a font, don't render any text. */
+	if(font == NULL)
+		goto out;
+
+	/* Text that is too wide is truncated rather than failing to render.
+	 * The logical order is truncated, so that the end of the text is
+	 * removed regardless of its direction. */
+	truncated = font_truncate_text(ctx, set, s, font, str, max_w);
+	if(truncated != NULL)
+		str = truncated;
+
+	if(q == FONT_QUALITY_LOW)
+		TTF_Render_fn = TTF_RenderUTF8_Solid;
 	else
+		TTF_Render_fn = TTF_RenderUTF8_Blended;
+
+	{
+		/* Render text on tile. */
+		SDL_Surface *surf;
+		const char *visual = str;
+
+#ifndef NO_FRIBIDI
+		/* Most strings have no right-to-left text, and so are already
+		 * in visual order. */
+		if(font_needs_bidi(str) == SDL_TRUE)
+		{
+			visual = font_bidi_reorder(&set->bidi, str);
+			if(visual == NULL)
+				goto out;
+		}
+#endif
+
+		if(s == FONT_STYLE_REGULAR)
+			surf = font_render_runs(ctx, set, visual, TTF_Render_fn,
+				fg);
+		else
+			surf = TTF_Render_fn(font, visual, fg);
+
+		if(surf == NULL)
+			goto out;
+
+		if(surf->w > ctx->tex_min_w || surf->h > ctx->tex_min_h)
+		{
+			SDL_LogError(HAIYAJAN_LOG_CATEGORY_FONT,
+				     "Text size (%ux%u) exceeds maximum texture size (%ux%u).",
+				     surf->w, surf->h, ctx->tex_min_w, ctx->tex_min_h);
+			SDL_FreeSurface(surf);
+		}
+		else
+		{
+			ret = surf;
+		}
+	}
+
+out:
+	SDL_free(truncated);
+	return ret;
+}
+
+SDL_Surface *font_render_icon(font_ctx_s *ctx, Uint16 icon, SDL_Colour fg)
+{
+	return font_render_icon_set(ctx, &ctx->fonts, icon, fg);
+}
+
+SDL_Surface *font_render_text(font_ctx_s *ctx, const char *str,
+	font_style_e s, font_quality_e q, SDL_Colour fg, int max_w)
+{
+	return font_render_text_set(ctx, &ctx->fonts, str, s, q, fg, max_w);
+}
+
+/**
+ * Sets the size of a set of fonts, emptying its atlases and metrics.
+ */
+static void font_set_size(struct font_set *set, const struct font_size *sz)
+{
+	for(unsigned i = 0; i < FONT_STYLE_MAX; i++)
 	{
-		tex = SDL_CreateTextureFromSurface(ctx->rend, surf);
+		glyph_atlas_reset(&set->atlas[i]);
+		font_metrics_reset(&set->metrics[i]);
 	}
 
-	SDL_FreeSurface(surf);
+	glyph_atlas_reset(&set->icon_overflow);
+	set->icons_ready = SDL_FALSE;
+
+	set->size = *sz;
+	TTF_SetFontSizeDPI(set->ui_icons, sz->pt[FONT_STYLE_ICON],
+		sz->hdpi, sz->vdpi);
+	TTF_SetFontSizeDPI(set->ui_header, sz->pt[FONT_STYLE_HEADER],
+		sz->hdpi, sz->vdpi);
+
+	for(unsigned i = 0; i < SDL_arraysize(set->ui_regular); i++)
+	{
+		/* Fonts that are not yet opened are set to this size when
+		 * they are opened. */
+		if(set->ui_regular[i] == NULL)
+			continue;
 
-out:
-	return tex;
+		TTF_SetFontSizeDPI(set->ui_regular[i],
+			sz->pt[FONT_STYLE_REGULAR], sz->hdpi, sz->vdpi);
+	}
 }
 
-SDL_Texture *font_render_text(font_ctx_s *ctx, const char *str,
-	font_style_e s, font_quality_e q, SDL_Colour fg)
+/**
+ * Renders queued requests until the font context is freed.
+ */
+static int font_worker_main(void *data)
 {
-	SDL_Texture *ret = NULL;
-	TTF_Font *font = NULL;
-	SDL_Surface *(*TTF_Render_fn)(TTF_Font *, const char *, SDL_Colour);
-
-	SDL_assert(ctx != NULL);
-	SDL_assert(str != NULL);
+	struct font_worker *w = data;
+	font_ctx_s *ctx = w->ctx;
 
-	switch(s)
+	SDL_LockMutex(ctx->jobs_lock);
+	for(;;)
 	{
-	case FONT_STYLE_HEADER:
-		font = ctx->ui_header;
-		break;
+		struct font_job job;
+		struct font_result res;
 
-	case FONT_STYLE_ICON:
-		font = ctx->ui_icons;
-		break;
+		while(stb_arr_len(ctx->jobs) == 0 && ctx->quit == SDL_FALSE)
+			SDL_CondWait(ctx->jobs_cond, ctx->jobs_lock);
 
-	case FONT_STYLE_REGULAR:
-	default:
-		for(unsigned i = 0; i < SDL_arraysize(ctx->ui_regular); i++)
-		{
-			int is_prov;
-			TTF_Font *test;
+		if(ctx->quit == SDL_TRUE)
+			break;
 
-			test = ctx->ui_regular[i];
-			/* It is possible that the font is not available
-			 * on the running platform. */
-			if(test == NULL)
-				continue;
+		/* Requests are rendered in the order they were made, which is
+		 * the order that elements are drawn in. */
+		job = ctx->jobs[0];
+		stb_arr_delete(ctx->jobs, 0);
+		SDL_UnlockMutex(ctx->jobs_lock);
 
-			is_prov = TTF_GlyphIsProvided(test, str[0]);
-			if(is_prov == 0)
-				continue;
+		if(SDL_memcmp(&w->fonts.size, &job.size, sizeof(job.size)) != 0)
+			font_set_size(&w->fonts, &job.size);
 
-			font = test;
-			break;
+		res.id = job.id;
+		if(job.str != NULL)
+		{
+			res.surf = font_render_text_set(ctx, &w->fonts, job.str,
+				job.style, job.quality, job.fg, job.max_w);
+			SDL_free(job.str);
 		}
-
-		if(font == NULL)
+		else
 		{
-			/* Select any available font if unable to select a suitable one. */
-			for(unsigned i = 0; i < SDL_arraysize(ctx->ui_regular); i++)
-				font = ctx->ui_regular[i];
+			res.surf = font_render_icon_set(ctx, &w->fonts,
+				job.icon, job.fg);
 		}
 
-		break;
+		SDL_LockMutex(ctx->jobs_lock);
+		stb_arr_push(ctx->results, res);
 	}
+	SDL_UnlockMutex(ctx->jobs_lock);
 
-	/* If we still can't select a font, don't render any text. */
-	if(font == NULL)
-		goto out;
+	return 0;
+}
 
-	if(q == FONT_QUALITY_LOW)
-		TTF_Render_fn = TTF_RenderUTF8_Solid;
-	else
-		TTF_Render_fn = TTF_RenderUTF8_Blended;
+/**
+ * Queues a request for a worker.
+ *
+ * \return	0 on success, or -1 if there are no workers.
+ */
+static int font_queue_job(font_ctx_s *ctx, struct font_job *job)
+{
+	if(ctx->worker_count == 0)
+		return -1;
 
-	{
-		/* Render text on tile. */
-		SDL_Surface *surf;
+	SDL_LockMutex(ctx->jobs_lock);
+	job->size = ctx->fonts.size;
+	stb_arr_push(ctx->jobs, *job);
+	SDL_CondSignal(ctx->jobs_cond);
+	SDL_UnlockMutex(ctx->jobs_lock);
 
-#ifndef NO_FRIBIDI
-		char *strutf8_out;
-		FriBidiChar *instr, *outstr;
-		FriBidiParType biditype = FRIBIDI_PAR_ON;
-		FriBidiStrIndex strinlen;
-		size_t instrlen = SDL_strlen(str);
-
-		instr = SDL_malloc(instrlen * sizeof(FriBidiChar));
-		if(instr == NULL)
-			goto out;
+	return 0;
+}
 
-		outstr = SDL_malloc(instrlen * sizeof(FriBidiChar));
-		if(outstr == NULL)
-		{
-			free(instr);
-			goto out;
-		}
+#ifndef NO_UNIFONT
+/**
+ * Checks whether a string requires the fallback font, which workers do not
+ * use. Must only be called from the main thread.
+ */
+static SDL_bool font_needs_fallback(font_ctx_s *ctx, const char *str)
+{
+	const char *p = str;
 
-		strinlen = fribidi_charset_to_unicode(FRIBIDI_CHAR_SET_UTF8, str,
-				(FriBidiStrIndex)instrlen, instr);
+	if(SDL_AtomicGet(&ctx->unifont_failed) != 0)
+		return SDL_FALSE;
 
-		fribidi_log2vis(instr, strinlen, &biditype, outstr, NULL, NULL, NULL);
-		SDL_free(instr);
+	while(*p != '\0')
+	{
+		const Uint32 cp = font_utf8_next(&p);
 
-		strutf8_out = SDL_malloc(instrlen);
-		if(strutf8_out == NULL)
-		{
-			free(outstr);
-			goto out;
-		}
+		/* The first regular font always provides ASCII. */
+		if(cp < 0x80 || cp >= 0x10000)
+			continue;
 
-		fribidi_unicode_to_charset(FRIBIDI_CHAR_SET_UTF8, outstr, strinlen, strutf8_out);
-		SDL_free(outstr);
+		if(font_select_regular(ctx, &ctx->fonts, cp) == FONT_FALLBACK)
+			return SDL_TRUE;
+	}
 
-		surf = TTF_Render_fn(font, strutf8_out, fg);
-		SDL_free(strutf8_out);
-#else
-		surf = TTF_Render_fn(font, str, fg);
+	return SDL_FALSE;
+}
 #endif
 
-		if(surf == NULL)
-			goto out;
+int font_render_text_async(font_ctx_s *ctx, Uint64 id, const char *str,
+	font_style_e s, font_quality_e q, SDL_Colour fg, int max_w)
+{
+	struct font_job job = { 0 };
 
-		if(surf->w > ctx->tex_min_w || surf->h > ctx->tex_min_h)
-		{
-			SDL_LogError(HAIYAJAN_LOG_CATEGORY_FONT,
-				     "Text size (%ux%u) exceeds maximum texture size (%ux%u).",
-				     surf->w, surf->h, ctx->tex_min_w, ctx->tex_min_h);
-		}
-		else
-		{
-			ret = SDL_CreateTextureFromSurface(ctx->rend, surf);
-		}
+	if(ctx->worker_count == 0)
+		return -1;
 
-		SDL_FreeSurface(surf);
+#ifndef NO_UNIFONT
+	/* Text that requires Unifont is rendered on the main thread, which
+	 * holds the only instance of it. */
+	if(s == FONT_STYLE_REGULAR && font_needs_fallback(ctx, str) == SDL_TRUE)
+		return -1;
+#endif
+
+	job.id = id;
+	job.str = SDL_strdup(str);
+	if(job.str == NULL)
+		return -1;
+
+	job.style = s;
+	job.quality = q;
+	job.fg = fg;
+	job.max_w = max_w;
+	return font_queue_job(ctx, &job);
+}
+
+int font_render_icon_async(font_ctx_s *ctx, Uint64 id, Uint16 icon,
+	SDL_Colour fg)
+{
+	struct font_job job = { 0 };
+
+	job.id = id;
+	job.icon = icon;
+	job.style = FONT_STYLE_ICON;
+	job.quality = FONT_QUALITY_HIGH;
+	job.fg = fg;
+	return font_queue_job(ctx, &job);
+}
+
+int font_collect_render(font_ctx_s *ctx, Uint64 *id, SDL_Surface **surf)
+{
+	int ret = 0;
+
+	if(ctx->worker_count == 0)
+		return 0;
+
+	SDL_LockMutex(ctx->jobs_lock);
+	if(stb_arr_len(ctx->results) > 0)
+	{
+		struct font_result res = stb_arr_pop(ctx->results);
+
+		*id = res.id;
+		*surf = res.surf;
+		ret = 1;
 	}
+	SDL_UnlockMutex(ctx->jobs_lock);
 
-out:
 	return ret;
 }
 
-static void font_close_ttf(font_ctx_s *ctx)
+/**
+ * Discards all queued requests and results that have not been collected.
+ * Must be called with jobs_lock held.
+ */
+static void font_discard_jobs(font_ctx_s *ctx)
 {
-	TTF_CloseFont(ctx->ui_header);
-	TTF_CloseFont(ctx->ui_icons);
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(ctx->jobs); i++)
+		SDL_free(ctx->jobs[i].str);
 
-	ctx->ui_header = NULL;
-	ctx->ui_icons = NULL;
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(ctx->results); i++)
+		SDL_FreeSurface(ctx->results[i].surf);
 
-	for(unsigned i = 0; i < MAX_FONTS; i++)
+	stb_arr_setlen(ctx->jobs, 0);
+	stb_arr_setlen(ctx->results, 0);
+}
+
+/**
+ * Opens a further instance of the fonts that were opened by font_read_ttf(),
+ * for use by a worker. Only the first regular font is opened here, as the
+ * others are opened when first needed.
+ */
+static void font_open_set(font_ctx_s *ctx, struct font_set *set)
+{
+	const char *loc = ctx->regular_path[0];
+
+	SDL_LockMutex(ctx->open_lock);
+	set->ui_header = font_open_mem(
+		NotoSansDisplay_SemiCondensedLight_Latin_ttf,
+		NotoSansDisplay_SemiCondensedLight_Latin_ttf_len);
+	set->ui_icons = font_open_mem(fabric_icons_ttf, fabric_icons_ttf_len);
+
+	if(loc != NULL)
+		set->ui_regular[0] = font_open_file(loc);
+	else
+		set->ui_regular[0] = font_open_mem(
+			NotoSansDisplay_Regular_Latin_ttf,
+			NotoSansDisplay_Regular_Latin_ttf_len);
+	SDL_UnlockMutex(ctx->open_lock);
+}
+
+static void font_close_ttf(font_ctx_s *ctx, struct font_set *set)
+{
+	SDL_LockMutex(ctx->open_lock);
+	TTF_CloseFont(set->ui_header);
+	TTF_CloseFont(set->ui_icons);
+
+	set->ui_header = NULL;
+	set->ui_icons = NULL;
+
+	for(unsigned i = 0; i < SDL_arraysize(set->ui_regular); i++)
 	{
-		TTF_CloseFont(ctx->ui_regular[i]);
-		ctx->ui_regular[i] = NULL;
+		TTF_CloseFont(set->ui_regular[i]);
+		set->ui_regular[i] = NULL;
 	}
+	SDL_UnlockMutex(ctx->open_lock);
+
+	set->regular_failed = 0;
+
+#ifndef NO_FRIBIDI
+	font_bidi_free(&set->bidi);
+#endif
+}
+
+SDL_bool font_discovery_pending(font_ctx_s *ctx)
+{
+	if(ctx->index == NULL)
+		return SDL_FALSE;
+
+	return font_index_is_ready(ctx->index) == SDL_TRUE ?
+		SDL_FALSE : SDL_TRUE;
 }
 
 int font_get_height(font_ctx_s *ctx, font_style_e style)
 {
 	TTF_Font *f[] = {
-		ctx->ui_regular[0], ctx->ui_header, ctx->ui_icons
+		ctx->fonts.ui_regular[0], ctx->fonts.ui_header,
+		ctx->fonts.ui_icons
 	};
 
 	SDL_assert(ctx != NULL);
@@ -217,6 +2307,121 @@ int font_get_height(font_ctx_s *ctx, font_style_e style)
 	return TTF_FontHeight(f[style]);
 }
 
+int font_get_height_at(font_ctx_s *ctx, font_style_e style, int pt,
+	unsigned vdpi)
+{
+	const struct font_size *cur = &ctx->fonts.size;
+	int cur_pt = cur->pt[style];
+	unsigned cur_vdpi = cur->vdpi;
+
+	SDL_assert(ctx != NULL);
+	SDL_assert(style < FONT_STYLE_MAX);
+
+	/* The height at a recently used size is known exactly. */
+	for(unsigned i = 0; i < FONT_POOL_SIZE; i++)
+	{
+		const struct font_set *set = &ctx->pool[i];
+		TTF_Font *f[] = {
+			set->ui_regular[0], set->ui_header, set->ui_icons
+		};
+
+		if(set->ui_icons == NULL || set->size.pt[style] != pt ||
+			set->size.vdpi != vdpi)
+			continue;
+
+		return TTF_FontHeight(f[style]);
+	}
+
+	if(cur_vdpi == 0)
+	{
+		cur_pt = FONT_OPEN_PT;
+		cur_vdpi = FONT_OPEN_DPI;
+	}
+
+	/* Otherwise, the height is scaled from that at the current size, which
+	 * may differ from the height of the font at the given size by a pixel
+	 * due to rounding. */
+	return (int)SDL_ceilf((float)font_get_height(ctx, style) *
+		(float)(pt * (int)vdpi) / (float)(cur_pt * (int)cur_vdpi));
+}
+
+/**
+ * Changes the fonts used by the render thread to the given size. Resizing a
+ * font discards the glyphs that FreeType has cached for it, so fonts at
+ * recently used sizes are kept open and are used again when returning to
+ * their size, such as when moving between windowed and fullscreen modes.
+ */
+static void font_use_size(font_ctx_s *ctx, const struct font_size *sz)
+{
+	struct font_set set;
+	unsigned i;
+
+	/* The fonts have not been used at any size yet. */
+	if(ctx->fonts.size.vdpi == 0)
+	{
+		font_set_size(&ctx->fonts, sz);
+		return;
+	}
+
+	for(i = 0; i < FONT_POOL_SIZE; i++)
+	{
+		if(ctx->pool[i].ui_icons != NULL &&
+			SDL_memcmp(&ctx->pool[i].size, sz, sizeof(*sz)) == 0)
+			break;
+	}
+
+	/* Otherwise, the least recently used set is opened or resized. */
+	if(i == FONT_POOL_SIZE)
+		i = FONT_POOL_SIZE - 1;
+
+	set = ctx->pool[i];
+	if(set.ui_icons == NULL)
+	{
+		font_open_set(ctx, &set);
+		if(set.ui_header == NULL || set.ui_icons == NULL ||
+			set.ui_regular[0] == NULL)
+		{
+			SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_FONT,
+				"Unable to open fonts at a further size: %s",
+				SDL_GetError());
+			font_close_ttf(ctx, &set);
+			font_set_size(&ctx->fonts, sz);
+			return;
+		}
+	}
+
+	if(SDL_memcmp(&set.size, sz, sizeof(*sz)) != 0)
+		font_set_size(&set, sz);
+
+	SDL_memmove(&ctx->pool[1], &ctx->pool[0], i * sizeof(*ctx->pool));
+	ctx->pool[0] = ctx->fonts;
+	ctx->fonts = set;
+}
+
+/**
+ * Sets the size of the fonts that scaled glyphs are rasterised with to the
+ * point sizes of the current fonts at the reference DPI.
+ *
+ * \return	SDL_TRUE if the size has changed, so that glyphs rasterised at
+ *		the previous size must be discarded.
+ */
+static SDL_bool font_set_scaled_size(font_ctx_s *ctx)
+{
+	struct font_size ref = ctx->fonts.size;
+
+	/* Font sizes have not been set yet. */
+	if(ctx->fonts.size.vdpi == 0)
+		return SDL_FALSE;
+
+	ref.hdpi = GLYPH_SCALED_REF_DPI;
+	ref.vdpi = GLYPH_SCALED_REF_DPI;
+	if(SDL_memcmp(&ref, &ctx->scaled_fonts.size, sizeof(ref)) == 0)
+		return SDL_FALSE;
+
+	font_set_size(&ctx->scaled_fonts, &ref);
+	return SDL_TRUE;
+}
+
 /**
  * Initialise fonts given a DPI. This function always succeeds; a backup font is
  * used if a font cannot be found on the running platform.
@@ -227,52 +2432,81 @@ int font_get_height(font_ctx_s *ctx, font_style_e style)
 void font_change_pt(font_ctx_s *ctx, unsigned hdpi, unsigned vdpi,
 		int icon_pt, int header_pt, int regular_pt)
 {
-	SDL_assert(ctx->ui_icons != NULL);
-	SDL_assert(ctx->ui_header != NULL);
-	SDL_assert(ctx->ui_regular[0] != NULL);
+	struct font_size sz;
+
+	SDL_assert(ctx->fonts.ui_icons != NULL);
+	SDL_assert(ctx->fonts.ui_header != NULL);
+	SDL_assert(ctx->fonts.ui_regular[0] != NULL);
+
+	sz.pt[FONT_STYLE_ICON] = icon_pt;
+	sz.pt[FONT_STYLE_HEADER] = header_pt;
+	sz.pt[FONT_STYLE_REGULAR] = regular_pt;
+	sz.hdpi = hdpi;
+	sz.vdpi = vdpi;
+
+	/* Nothing rendered at the current size needs to be discarded. */
+	if(SDL_memcmp(&sz, &ctx->fonts.size, sizeof(sz)) == 0)
+		return;
+
+	/* Each set of fonts keeps the glyphs rasterised at its size, so
+	 * glyphs are only rasterised again if the set was resized. Queued
+	 * requests are rendered at the size they were made at, as workers set
+	 * the size of their own fonts when they take a request. */
+	font_use_size(ctx, &sz);
+	if(ctx->scaled == SDL_TRUE)
+		font_set_scaled_size(ctx);
+
+	if(font_atlas_set(ctx)->icons_ready == SDL_FALSE)
+		font_rasterise_icons(ctx);
+}
+
+/**
+ * Records the code points provided by each regular font, so that fonts are
+ * not probed each time text is rendered.
+ */
+static void font_build_coverage(font_ctx_s *ctx)
+{
+	const unsigned count = (unsigned)SDL_AtomicGet(&ctx->regular_count);
+	const Uint32 start_ms = SDL_GetTicks();
+	unsigned built = 0;
 
-	TTF_SetFontSizeDPI(ctx->ui_icons, icon_pt, hdpi, vdpi);
-	TTF_SetFontSizeDPI(ctx->ui_header, header_pt, hdpi, vdpi);
+	if(font_has_choice(ctx) == SDL_FALSE)
+		return;
 
-	for(unsigned i = 0; i < MAX_FONTS; i++)
+	for(unsigned i = 0; i < count; i++)
 	{
-		if(ctx->ui_regular[i] == NULL)
-			break;
-
-		TTF_SetFontSizeDPI(ctx->ui_regular[i], regular_pt, hdpi, vdpi);
+		/* If the map cannot be built, the font is probed instead. */
+		ctx->coverage[i] = font_read_coverage(ctx, i,
+			ctx->fonts.ui_regular[i]);
+		if(ctx->coverage[i] != NULL)
+			built++;
 	}
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+		"Recorded coverage of %u fonts in %u ms", built,
+		SDL_GetTicks() - start_ms);
 }
 
 static void font_read_ttf(font_ctx_s *ctx)
 {
-	SDL_assert_paranoid(ctx->ui_icons == NULL);
-	SDL_assert_paranoid(ctx->ui_header == NULL);
-	SDL_assert_paranoid(ctx->ui_regular[0] == NULL);
+	SDL_assert_paranoid(ctx->fonts.ui_icons == NULL);
+	SDL_assert_paranoid(ctx->fonts.ui_header == NULL);
+	SDL_assert_paranoid(ctx->fonts.ui_regular[0] == NULL);
 
 	/* Load built-in header font. */
-	{
-		SDL_RWops *hdr_font_mem;
-		hdr_font_mem = SDL_RWFromConstMem(NotoSansDisplay_SemiCondensedLight_Latin_ttf,
-						  NotoSansDisplay_SemiCondensedLight_Latin_ttf_len);
-		ctx->ui_header = TTF_OpenFontRW(hdr_font_mem, 1, 12);
-	}
+	ctx->fonts.ui_header = font_open_mem(
+		NotoSansDisplay_SemiCondensedLight_Latin_ttf,
+		NotoSansDisplay_SemiCondensedLight_Latin_ttf_len);
 
 	/* Load built-in icon font. */
-	{
-		SDL_RWops *icon_font_mem;
-		icon_font_mem = SDL_RWFromConstMem(fabric_icons_ttf,
-						   fabric_icons_ttf_len);
-		ctx->ui_icons = TTF_OpenFontRW(icon_font_mem, 1, 12);
-	}
+	ctx->fonts.ui_icons = font_open_mem(fabric_icons_ttf,
+		fabric_icons_ttf_len);
 
 	/* Load built-in regular font in-case platform dependant fonts cannot
 	 * be loaded below. */
-	{
-		SDL_RWops *font_mem;
-		font_mem = SDL_RWFromConstMem(NotoSansDisplay_Regular_Latin_ttf,
-					      NotoSansDisplay_Regular_Latin_ttf_len);
-		ctx->ui_regular[0] = TTF_OpenFontRW(font_mem, 1, 12);
-	}
+	ctx->fonts.ui_regular[0] = font_open_mem(
+		NotoSansDisplay_Regular_Latin_ttf,
+		NotoSansDisplay_Regular_Latin_ttf_len);
 
 #if defined(__WINDOWS__)
 	char win[MAX_PATH];
@@ -284,7 +2518,7 @@ static void font_read_ttf(font_ctx_s *ctx)
 		goto out;
 
 	/* Initialise fonts from the given locations. */
-	for(unsigned i = 0, s = 0; i < SDL_arraysize(ctx->ui_regular); i++)
+	for(unsigned i = 0, s = 0; i < MAX_FONTS; i++)
 	{
 		const char *ui_regular_locs[MAX_FONTS] = {
 			"SEGOEUI.TTF",	/* Latin */
@@ -301,15 +2535,49 @@ static void font_read_ttf(font_ctx_s *ctx)
 			ui_regular_locs[i]);
 
 		/* Errors are ignored. */
-		ctx->ui_regular[s] = TTF_OpenFont(loc, 12);
-		if(ctx->ui_regular[s] == NULL)
+		if(GetFileAttributesA(loc) == INVALID_FILE_ATTRIBUTES)
 			continue;
 
-		/* If a font is successfully opened, move to next pointer. */
+		/* The first font renders most text, so it replaces the
+		 * built-in font now. Large fonts such as CJK and emoji faces
+		 * are only opened when a code point that they provide is
+		 * rendered. */
+		if(s == 0)
+		{
+			TTF_Font *f = font_open_file(loc);
+
+			if(f == NULL)
+				continue;
+
+			TTF_CloseFont(ctx->fonts.ui_regular[0]);
+			ctx->fonts.ui_regular[0] = f;
+		}
+
+		ctx->regular_path[s] = SDL_strdup(loc);
+		if(ctx->regular_path[s] == NULL)
+			break;
+
+		/* If a font is found, move to next pointer. */
 		s++;
 	}
 
 #elif defined(__LINUX__)
+	char *pref;
+	char loc[2048];
+	const char *index_loc = NULL;
+
+	/* Installed fonts are only opened when a code point that the built-in
+	 * font does not provide is rendered. */
+	pref = SDL_GetPrefPath(HAIYAJAN_PREF_ORG, HAIYAJAN_PREF_APP);
+	if(pref != NULL)
+	{
+		SDL_snprintf(loc, sizeof(loc), "%s%s", pref,
+			FONT_INDEX_FILENAME);
+		index_loc = loc;
+		SDL_free(pref);
+	}
+
+	ctx->index = font_index_open(index_loc);
 #elif defined(__FREEBSD__)
 #elif defined(__MACOSX__)
 #else
@@ -318,7 +2586,103 @@ static void font_read_ttf(font_ctx_s *ctx)
 	/* Suppresses unused goto on certain configurations. */
 	goto out;
 out:
+	{
+		unsigned count = 0;
+
+		/* Fonts after the first may not be opened yet. */
+		while(count < MAX_FONTS &&
+			(ctx->fonts.ui_regular[count] != NULL ||
+			ctx->regular_path[count] != NULL))
+			count++;
+
+		SDL_AtomicSet(&ctx->regular_count, (int)count);
+	}
+
+	font_build_coverage(ctx);
+	return;
+}
+
+/**
+ * Starts threads that render text in the background. Each worker has its own
+ * instance of every font, opened here on the calling thread. If no workers
+ * can be started, text is only rendered on the calling thread.
+ */
+static void font_start_workers(font_ctx_s *ctx)
+{
+	/* Leave a core for the render thread. */
+	int count = SDL_GetCPUCount() - 1;
+
+	count = SDL_min(count, FONT_WORKERS_MAX);
+	if(count <= 0)
+		return;
+
+	ctx->jobs_lock = SDL_CreateMutex();
+	ctx->jobs_cond = SDL_CreateCond();
+	if(ctx->jobs_lock == NULL || ctx->jobs_cond == NULL)
+		goto err;
+
+	for(int i = 0; i < count; i++)
+	{
+		struct font_worker *w = &ctx->workers[ctx->worker_count];
+
+		w->ctx = ctx;
+		w->fonts.worker = SDL_TRUE;
+		font_open_set(ctx, &w->fonts);
+		if(w->fonts.ui_header == NULL || w->fonts.ui_icons == NULL ||
+			w->fonts.ui_regular[0] == NULL)
+		{
+			font_close_ttf(ctx, &w->fonts);
+			break;
+		}
+
+		w->thread = SDL_CreateThread(font_worker_main, "font", w);
+		if(w->thread == NULL)
+		{
+			font_close_ttf(ctx, &w->fonts);
+			break;
+		}
+
+		ctx->worker_count++;
+	}
+
+	if(ctx->worker_count == 0)
+		goto err;
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+		"Started %u font rendering threads", ctx->worker_count);
 	return;
+
+err:
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+		"Unable to start font rendering threads: %s", SDL_GetError());
+	SDL_DestroyCond(ctx->jobs_cond);
+	SDL_DestroyMutex(ctx->jobs_lock);
+	ctx->jobs_cond = NULL;
+	ctx->jobs_lock = NULL;
+}
+
+static void font_stop_workers(font_ctx_s *ctx)
+{
+	if(ctx->worker_count == 0)
+		return;
+
+	SDL_LockMutex(ctx->jobs_lock);
+	ctx->quit = SDL_TRUE;
+	SDL_CondBroadcast(ctx->jobs_cond);
+	SDL_UnlockMutex(ctx->jobs_lock);
+
+	for(unsigned i = 0; i < ctx->worker_count; i++)
+	{
+		SDL_WaitThread(ctx->workers[i].thread, NULL);
+		font_close_ttf(ctx, &ctx->workers[i].fonts);
+	}
+
+	font_discard_jobs(ctx);
+	stb_arr_free(ctx->jobs);
+	stb_arr_free(ctx->results);
+	SDL_DestroyCond(ctx->jobs_cond);
+	SDL_DestroyMutex(ctx->jobs_lock);
+	ctx->worker_count = 0;
 }
 
 font_ctx_s *font_init(SDL_Renderer *rend)
@@ -335,6 +2699,13 @@ font_ctx_s *font_init(SDL_Renderer *rend)
 		goto out;
 
 	ctx->rend = rend;
+	ctx->open_lock = SDL_CreateMutex();
+	if(ctx->open_lock == NULL)
+	{
+		SDL_free(ctx);
+		ctx = NULL;
+		goto out;
+	}
 
 	{
 		SDL_RendererInfo rend_info;
@@ -358,12 +2729,88 @@ font_ctx_s *font_init(SDL_Renderer *rend)
 
 	font_read_ttf(ctx);
 
+	for(unsigned i = 0; i < FONT_STYLE_MAX; i++)
+		font_metrics_reset(&ctx->fonts.metrics[i]);
+	font_start_workers(ctx);
+
 out:
 	return ctx;
 }
 
+void font_set_scaled_glyphs(font_ctx_s *ctx, SDL_bool enable)
+{
+	SDL_assert(ctx != NULL);
+
+	if(enable == ctx->scaled)
+		return;
+
+	if(enable == SDL_TRUE && ctx->scaled_fonts.ui_icons == NULL)
+	{
+		font_open_set(ctx, &ctx->scaled_fonts);
+		if(ctx->scaled_fonts.ui_header == NULL ||
+			ctx->scaled_fonts.ui_icons == NULL ||
+			ctx->scaled_fonts.ui_regular[0] == NULL)
+		{
+			SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_FONT,
+				"Unable to open fonts for scaled glyphs: %s",
+				SDL_GetError());
+			font_close_ttf(ctx, &ctx->scaled_fonts);
+			return;
+		}
+
+		/* Force the size to be set. */
+		SDL_zero(ctx->scaled_fonts.size);
+	}
+
+	ctx->scaled = enable;
+	if(enable == SDL_TRUE)
+		font_set_scaled_size(ctx);
+
+	/* Glyphs are drawn from the atlases of the other set of fonts. */
+	if(font_atlas_set(ctx)->icons_ready == SDL_FALSE)
+		font_rasterise_icons(ctx);
+}
+
+/**
+ * Frees the atlases and metrics of a set of fonts.
+ */
+static void font_free_glyphs(struct font_set *set)
+{
+	for(unsigned i = 0; i < FONT_STYLE_MAX; i++)
+	{
+		glyph_atlas_free(&set->atlas[i]);
+		SDL_free(set->metrics[i].table);
+	}
+
+	glyph_atlas_free(&set->icon_overflow);
+}
+
 void font_exit(font_ctx_s *ctx)
 {
-	font_close_ttf(ctx);
+	font_free_glyphs(&ctx->fonts);
+	font_free_glyphs(&ctx->scaled_fonts);
+	for(unsigned i = 0; i < FONT_POOL_SIZE; i++)
+		font_free_glyphs(&ctx->pool[i]);
+
+	stb_arr_free(ctx->icons);
+	font_stop_workers(ctx);
+	font_close_ttf(ctx, &ctx->fonts);
+	font_close_ttf(ctx, &ctx->scaled_fonts);
+
+	for(unsigned i = 0; i < FONT_POOL_SIZE; i++)
+		font_close_ttf(ctx, &ctx->pool[i]);
+#ifndef NO_UNIFONT
+	TTF_CloseFont(ctx->unifont);
+#endif
+	font_index_close(ctx->index);
+
+	for(unsigned i = 0; i < MAX_FONTS; i++)
+	{
+		SDL_free(ctx->regular_path[i]);
+		SDL_free(ctx->coverage[i]);
+	}
+
+	SDL_DestroyMutex(ctx->open_lock);
+
 	SDL_free(ctx);
 }
@@ -0,0 +1,1242 @@
+/**
+ * Discovery of fonts installed on the system.
+ * Copyright (C) 2022 Mahyar Koshkouei
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ */
+
+#include "all.h"
+#include "fontindex.h"
+#include "SDL.h"
+#include "stb_arr.h"
+
+#if defined(__LINUX__)
+# include <dirent.h>
+# include <sys/stat.h>
+# define FONT_INDEX_SCAN
+#endif
+
+#define FONT_INDEX_MAGIC	SDL_FOURCC('H', 'Y', 'F', 'I')
+#define FONT_INDEX_VERSION	1
+
+/* Code points within the Basic Multilingual Plane are described in blocks of
+ * 256. Code points within the next two planes, which hold rarer scripts, emoji
+ * and CJK extensions, are described in blocks of 4096. */
+#define FONT_INDEX_BMP_BLOCKS	256
+#define FONT_INDEX_SUP_BLOCKS	32
+#define FONT_INDEX_BLOCKS	(FONT_INDEX_BMP_BLOCKS + FONT_INDEX_SUP_BLOCKS)
+#define FONT_INDEX_BLOCK_WORDS	(FONT_INDEX_BLOCKS / 32)
+#define FONT_INDEX_LAST_CP	0x2FFFF
+
+/* Depth of directories scanned below each font directory. Also stops loops
+ * of symbolic links. */
+#define FONT_INDEX_MAX_DEPTH	8
+
+/* Limit on the number of records read from an index file. */
+#define FONT_INDEX_MAX_RECORDS	(1 << 20)
+
+/* Limits on tables read from font files, so that corrupt files are rejected
+ * quickly. */
+#define SFNT_MAX_TABLES		512
+#define SFNT_MAX_SUBTABLES	64
+#define SFNT_MAX_GROUPS		0x110000
+
+#define SFNT_TAG(a, b, c, d)	(((Uint32)(a) << 24) | ((Uint32)(b) << 16) | \
+				 ((Uint32)(c) << 8) | (Uint32)(d))
+
+/* Name identifiers within the name table. */
+#define SFNT_NAME_FAMILY	1
+#define SFNT_NAME_STYLE		2
+
+struct font_index_entry
+{
+	char *path;
+	/* Names of the font, or NULL if the font could not be read. */
+	char *family;
+	char *style;
+
+	/* Modification time and size of the file when it was read. */
+	Sint64 mtime;
+	Sint64 size;
+
+	/* Bitmap of the blocks of code points that the font provides. */
+	Uint32 blocks[FONT_INDEX_BLOCK_WORDS];
+
+	/* Whether the font has been returned by font_index_find(). */
+	SDL_bool taken;
+};
+
+struct font_index_dir
+{
+	char *path;
+	Sint64 mtime;
+};
+
+struct font_index
+{
+	/* Location that the index is saved to, or NULL. */
+	char *path;
+
+	/* Fonts sorted by path, and the directories that were scanned for
+	 * them. Only accessed by the scan thread until ready is set. */
+	struct font_index_entry *entries;
+	struct font_index_dir *dirs;
+
+	SDL_Thread *scan;
+	SDL_atomic_t ready;
+
+	/* Blocks for which every font has been returned by
+	 * font_index_find(). */
+	Uint32 searched[FONT_INDEX_BLOCK_WORDS];
+
+	/* Code points that no remaining font provides. */
+	Uint32 *missed;
+};
+
+/**
+ * Tables located within a font file.
+ */
+struct sfnt_tables
+{
+	Uint32 cmap_off;
+	Uint32 name_off;
+};
+
+typedef void (*sfnt_range_fn)(void *user, Uint32 first, Uint32 last);
+
+/**
+ * Obtains the block that a code point belongs to.
+ *
+ * \return	Block, or -1 if the code point is not described by the index.
+ */
+static int font_index_block(Uint32 cp)
+{
+	if(cp < 0x10000)
+		return (int)(cp >> 8);
+
+	if(cp <= FONT_INDEX_LAST_CP)
+		return FONT_INDEX_BMP_BLOCKS + (int)((cp - 0x10000) >> 12);
+
+	return -1;
+}
+
+static int sfnt_find_tables(SDL_RWops *rw, struct sfnt_tables *t)
+{
+	Uint32 tag;
+	Uint16 num;
+
+	if(SDL_RWseek(rw, 0, RW_SEEK_SET) < 0)
+		return -1;
+
+	tag = SDL_ReadBE32(rw);
+
+	/* Only the first font of a collection is used, as TTF_OpenFont()
+	 * opens the first font. */
+	if(tag == SFNT_TAG('t', 't', 'c', 'f'))
+	{
+		Uint32 face;
+
+		SDL_ReadBE32(rw);
+		if(SDL_ReadBE32(rw) == 0)
+			return -1;
+
+		face = SDL_ReadBE32(rw);
+		if(SDL_RWseek(rw, face, RW_SEEK_SET) < 0)
+			return -1;
+
+		tag = SDL_ReadBE32(rw);
+	}
+
+	if(tag != 0x00010000 && tag != SFNT_TAG('O', 'T', 'T', 'O') &&
+		tag != SFNT_TAG('t', 'r', 'u', 'e'))
+		return -1;
+
+	num = SDL_ReadBE16(rw);
+	if(num > SFNT_MAX_TABLES)
+		return -1;
+
+	/* Skip searchRange, entrySelector and rangeShift. */
+	if(SDL_RWseek(rw, 6, RW_SEEK_CUR) < 0)
+		return -1;
+
+	t->cmap_off = 0;
+	t->name_off = 0;
+	for(Uint16 i = 0; i < num; i++)
+	{
+		/* Tag, checksum, offset and length. */
+		Uint32 rec[4], rec_tag, off;
+
+		if(SDL_RWread(rw, rec, sizeof(rec), 1) != 1)
+			return -1;
+
+		rec_tag = SDL_SwapBE32(rec[0]);
+		off = SDL_SwapBE32(rec[2]);
+		if(rec_tag == SFNT_TAG('c', 'm', 'a', 'p'))
+			t->cmap_off = off;
+		else if(rec_tag == SFNT_TAG('n', 'a', 'm', 'e'))
+			t->name_off = off;
+	}
+
+	return t->cmap_off != 0 ? 0 : -1;
+}
+
+/**
+ * Reads the ranges of a segment mapping to delta values subtable. Segments are
+ * assumed to map every code point within them to a glyph.
+ */
+static int sfnt_read_format4(SDL_RWops *rw, sfnt_range_fn fn, void *user)
+{
+	Uint16 *codes;
+	unsigned segs;
+
+	/* Skip length and language. */
+	SDL_ReadBE16(rw);
+	SDL_ReadBE16(rw);
+	segs = SDL_ReadBE16(rw) / 2;
+	if(segs == 0)
+		return -1;
+
+	/* Skip searchRange, entrySelector and rangeShift. */
+	if(SDL_RWseek(rw, 6, RW_SEEK_CUR) < 0)
+		return -1;
+
+	/* End codes, reserved padding, then start codes. */
+	codes = SDL_malloc((segs * 2 + 1) * sizeof(*codes));
+	if(codes == NULL)
+		return -1;
+
+	if(SDL_RWread(rw, codes, sizeof(*codes), segs * 2 + 1) !=
+		segs * 2 + 1)
+	{
+		SDL_free(codes);
+		return -1;
+	}
+
+	for(unsigned i = 0; i < segs; i++)
+	{
+		Uint16 end = SDL_SwapBE16(codes[i]);
+		Uint16 start = SDL_SwapBE16(codes[segs + 1 + i]);
+
+		/* The final segment only maps 0xFFFF to the missing glyph. */
+		if(start > end || start == 0xFFFF)
+			continue;
+
+		fn(user, start, end);
+	}
+
+	SDL_free(codes);
+	return 0;
+}
+
+/**
+ * Reads the ranges of a segmented coverage subtable.
+ */
+static int sfnt_read_format12(SDL_RWops *rw, sfnt_range_fn fn, void *user)
+{
+	Uint32 groups;
+
+	/* Skip reserved, length and language. */
+	SDL_ReadBE16(rw);
+	SDL_ReadBE32(rw);
+	SDL_ReadBE32(rw);
+	groups = SDL_ReadBE32(rw);
+	if(groups == 0 || groups > SFNT_MAX_GROUPS)
+		return -1;
+
+	for(Uint32 i = 0; i < groups; i++)
+	{
+		/* First and last code points, and the first glyph. */
+		Uint32 group[3], first, last;
+
+		if(SDL_RWread(rw, group, sizeof(group), 1) != 1)
+			return -1;
+
+		first = SDL_SwapBE32(group[0]);
+		last = SDL_SwapBE32(group[1]);
+		if(first > last || last > 0x10FFFF)
+			continue;
+
+		fn(user, first, last);
+	}
+
+	return 0;
+}
+
+/**
+ * Reads the ranges of code points provided by a font from its character map.
+ */
+static int sfnt_read_cmap(SDL_RWops *rw, Uint32 cmap_off, sfnt_range_fn fn,
+	void *user)
+{
+	Uint32 best_off = 0;
+	int best_rank = 0;
+	Uint16 num;
+
+	if(SDL_RWseek(rw, cmap_off, RW_SEEK_SET) < 0)
+		return -1;
+
+	SDL_ReadBE16(rw);
+	num = SDL_ReadBE16(rw);
+	if(num > SFNT_MAX_SUBTABLES)
+		return -1;
+
+	for(Uint16 i = 0; i < num; i++)
+	{
+		/* Platform, encoding and offset. */
+		Uint16 rec[4], plat, enc;
+		Uint32 off;
+		int rank = 0;
+
+		if(SDL_RWread(rw, rec, sizeof(rec), 1) != 1)
+			return -1;
+
+		plat = SDL_SwapBE16(rec[0]);
+		enc = SDL_SwapBE16(rec[1]);
+		off = ((Uint32)SDL_SwapBE16(rec[2]) << 16) |
+			SDL_SwapBE16(rec[3]);
+
+		/* Maps of all of Unicode are preferred over maps of the Basic
+		 * Multilingual Plane. Variation sequences are not maps. */
+		if((plat == 3 && enc == 10) ||
+			(plat == 0 && (enc == 4 || enc == 6)))
+			rank = 2;
+		else if((plat == 3 && enc == 1) || (plat == 0 && enc <= 3))
+			rank = 1;
+
+		if(rank > best_rank)
+		{
+			best_rank = rank;
+			best_off = off;
+		}
+	}
+
+	if(best_rank == 0 ||
+		SDL_RWseek(rw, (Sint64)cmap_off + best_off, RW_SEEK_SET) < 0)
+		return -1;
+
+	switch(SDL_ReadBE16(rw))
+	{
+	case 4:
+		return sfnt_read_format4(rw, fn, user);
+
+	case 12:
+		return sfnt_read_format12(rw, fn, user);
+
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Reads a name of the font, preferring US English names.
+ *
+ * \return	UTF-8 string that must be freed with SDL_free(), or NULL.
+ */
+static char *sfnt_read_name(SDL_RWops *rw, Uint32 name_off, Uint16 name_id)
+{
+	Uint16 count, str_off;
+	Uint16 best_len = 0, best_off = 0, best_plat = 0;
+	int best_rank = 0;
+	Uint8 *raw;
+	char *str, *out;
+
+	if(SDL_RWseek(rw, name_off, RW_SEEK_SET) < 0)
+		return NULL;
+
+	SDL_ReadBE16(rw);
+	count = SDL_ReadBE16(rw);
+	str_off = SDL_ReadBE16(rw);
+
+	for(Uint16 i = 0; i < count; i++)
+	{
+		/* Platform, encoding, language, name, length and offset. */
+		Uint16 rec[6], plat, enc, lang, id, len, off;
+		int rank = 0;
+
+		if(SDL_RWread(rw, rec, sizeof(rec), 1) != 1)
+			return NULL;
+
+		plat = SDL_SwapBE16(rec[0]);
+		enc = SDL_SwapBE16(rec[1]);
+		lang = SDL_SwapBE16(rec[2]);
+		id = SDL_SwapBE16(rec[3]);
+		len = SDL_SwapBE16(rec[4]);
+		off = SDL_SwapBE16(rec[5]);
+
+		if(id != name_id || len == 0)
+			continue;
+
+		if(plat == 3 && lang == 0x0409)
+			rank = 4;
+		else if(plat == 3 || plat == 0)
+			rank = 3;
+		else if(plat == 1 && enc == 0)
+			rank = 2;
+
+		if(rank > best_rank)
+		{
+			best_rank = rank;
+			best_len = len;
+			best_off = off;
+			best_plat = plat;
+		}
+	}
+
+	if(best_rank == 0)
+		return NULL;
+
+	raw = SDL_malloc(best_len);
+	/* A UTF-16 code unit is at most three bytes in UTF-8. */
+	str = SDL_malloc((size_t)best_len * 3 / 2 + 1);
+	if(raw == NULL || str == NULL ||
+		SDL_RWseek(rw, (Sint64)name_off + str_off + best_off,
+			RW_SEEK_SET) < 0 ||
+		SDL_RWread(rw, raw, best_len, 1) != 1)
+	{
+		SDL_free(raw);
+		SDL_free(str);
+		return NULL;
+	}
+
+	out = str;
+	if(best_plat == 1)
+	{
+		/* Only the ASCII subset of Mac Roman is kept. */
+		for(Uint16 i = 0; i < best_len; i++)
+			*out++ = raw[i] < 0x80 ? (char)raw[i] : '?';
+	}
+	else
+	{
+		for(Uint16 i = 0; i + 1 < best_len; i += 2)
+		{
+			Uint16 u = (Uint16)((raw[i] << 8) | raw[i + 1]);
+
+			if(u < 0x80)
+			{
+				*out++ = (char)u;
+			}
+			else if(u < 0x800)
+			{
+				*out++ = (char)(0xC0 | (u >> 6));
+				*out++ = (char)(0x80 | (u & 0x3F));
+			}
+			else if(u >= 0xD800 && u <= 0xDFFF)
+			{
+				/* Names outside of the Basic Multilingual
+				 * Plane are not expected. */
+				*out++ = '?';
+			}
+			else
+			{
+				*out++ = (char)(0xE0 | (u >> 12));
+				*out++ = (char)(0x80 | ((u >> 6) & 0x3F));
+				*out++ = (char)(0x80 | (u & 0x3F));
+			}
+		}
+	}
+
+	*out = '\0';
+	SDL_free(raw);
+	return str;
+}
+
+struct font_index_coverage
+{
+	Uint8 *map;
+	size_t map_len;
+};
+
+static void font_index_mark_coverage(void *user, Uint32 first, Uint32 last)
+{
+	struct font_index_coverage *cov = user;
+	const Uint32 map_cp = (Uint32)SDL_min(cov->map_len * 8, 0x110000);
+
+	if(first >= map_cp)
+		return;
+
+	last = SDL_min(last, map_cp - 1);
+	for(Uint32 cp = first; cp <= last; cp++)
+		cov->map[cp / 8] |= (Uint8)(1 << (cp % 8));
+}
+
+int font_index_read_coverage(SDL_RWops *rw, Uint8 *map, size_t map_len)
+{
+	struct font_index_coverage cov = { map, map_len };
+	struct sfnt_tables t;
+
+	if(sfnt_find_tables(rw, &t) != 0)
+		return -1;
+
+	return sfnt_read_cmap(rw, t.cmap_off, font_index_mark_coverage, &cov);
+}
+
+struct font_index_provides
+{
+	Uint32 cp;
+	SDL_bool found;
+};
+
+static void font_index_check_cp(void *user, Uint32 first, Uint32 last)
+{
+	struct font_index_provides *p = user;
+
+	if(p->cp >= first && p->cp <= last)
+		p->found = SDL_TRUE;
+}
+
+/**
+ * Checks whether a font file provides a code point. The index only records
+ * blocks of code points, and fonts often provide part of a block.
+ */
+static SDL_bool font_index_provides(const char *path, Uint32 cp)
+{
+	struct font_index_provides p = { cp, SDL_FALSE };
+	SDL_RWops *rw = SDL_RWFromFile(path, "rb");
+	struct sfnt_tables t;
+
+	if(rw == NULL)
+		return SDL_FALSE;
+
+	if(sfnt_find_tables(rw, &t) != 0 ||
+		sfnt_read_cmap(rw, t.cmap_off, font_index_check_cp, &p) != 0)
+		p.found = SDL_FALSE;
+
+	SDL_RWclose(rw);
+	return p.found;
+}
+
+/**
+ * Scores how well a font matches the built-in fonts.
+ */
+static int font_index_score(const struct font_index_entry *e)
+{
+	int score = 0;
+
+	/* Prefer upright sans-serif fonts, which match the built-in
+	 * fonts. */
+	if(e->style != NULL && (SDL_strcasecmp(e->style, "Regular") == 0 ||
+		SDL_strcasecmp(e->style, "Book") == 0 ||
+		SDL_strcasecmp(e->style, "Normal") == 0))
+		score += 4;
+
+	if(SDL_strstr(e->family, "Sans") != NULL)
+		score += 2;
+
+	if(SDL_strstr(e->family, "Mono") == NULL)
+		score += 1;
+
+	return score;
+}
+
+SDL_bool font_index_is_ready(font_index_s *idx)
+{
+	return SDL_AtomicGet(&idx->ready) != 0 ? SDL_TRUE : SDL_FALSE;
+}
+
+const char *font_index_find(font_index_s *idx, Uint32 cp)
+{
+	const unsigned n = (unsigned)stb_arr_len(idx->entries);
+	struct font_index_entry *best = NULL;
+	/* Fonts that provide the block but not the code point. */
+	Uint8 *rejected;
+	unsigned candidates;
+	int block;
+
+	if(SDL_AtomicGet(&idx->ready) == 0)
+		return NULL;
+
+	block = font_index_block(cp);
+	if(block < 0)
+		return NULL;
+
+	if(idx->searched[block / 32] & (1u << (block % 32)))
+		return NULL;
+
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(idx->missed); i++)
+	{
+		if(idx->missed[i] == cp)
+			return NULL;
+	}
+
+	rejected = SDL_calloc((size_t)n + 1, 1);
+	if(rejected == NULL)
+		return NULL;
+
+	/* Candidates are checked in order of preference until one provides
+	 * the code point. */
+	for(;;)
+	{
+		int best_score = -1;
+
+		best = NULL;
+		candidates = 0;
+		for(unsigned i = 0; i < n; i++)
+		{
+			struct font_index_entry *e = &idx->entries[i];
+			int score;
+
+			if(e->taken == SDL_TRUE || e->family == NULL ||
+				(e->blocks[block / 32] &
+					(1u << (block % 32))) == 0)
+				continue;
+
+			candidates++;
+			if(rejected[i] != 0)
+				continue;
+
+			score = font_index_score(e);
+			if(score > best_score)
+			{
+				best_score = score;
+				best = e;
+			}
+		}
+
+		if(best == NULL)
+			break;
+
+		if(font_index_provides(best->path, cp) == SDL_TRUE)
+			break;
+
+		rejected[best - idx->entries] = 1;
+	}
+
+	SDL_free(rejected);
+
+	if(best == NULL)
+	{
+		/* A block is only known to be exhausted once no remaining
+		 * font provides any of it. Otherwise, other code points of the
+		 * block may still be provided by the remaining fonts. */
+		if(candidates == 0)
+			idx->searched[block / 32] |= 1u << (block % 32);
+		else
+			stb_arr_push(idx->missed, cp);
+
+		return NULL;
+	}
+
+	best->taken = SDL_TRUE;
+	if(candidates == 1)
+		idx->searched[block / 32] |= 1u << (block % 32);
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+		"Selected font '%s %s' for U+%04" SDL_PRIX32,
+		best->family, best->style != NULL ? best->style : "", cp);
+	return best->path;
+}
+
+static void font_index_free_entries(struct font_index_entry *entries)
+{
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(entries); i++)
+	{
+		SDL_free(entries[i].path);
+		SDL_free(entries[i].family);
+		SDL_free(entries[i].style);
+	}
+
+	stb_arr_free(entries);
+}
+
+static void font_index_free_dirs(struct font_index_dir *dirs)
+{
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(dirs); i++)
+		SDL_free(dirs[i].path);
+
+	stb_arr_free(dirs);
+}
+
+#ifdef FONT_INDEX_SCAN
+/**
+ * State of a scan of font directories.
+ */
+struct font_index_scan
+{
+	/* Fonts read by a previous scan, sorted by path. */
+	const struct font_index_entry *old;
+
+	struct font_index_entry *entries;
+	struct font_index_dir *dirs;
+
+	/* Number of font files that were read, rather than being taken from
+	 * the previous scan. */
+	unsigned read;
+};
+
+/**
+ * Cursor over an index file loaded into memory.
+ */
+struct font_index_cursor
+{
+	const Uint8 *p;
+	size_t left;
+	SDL_bool ok;
+};
+
+static Uint32 cursor_le32(struct font_index_cursor *c)
+{
+	Uint32 v;
+
+	if(c->left < 4)
+	{
+		c->ok = SDL_FALSE;
+		return 0;
+	}
+
+	v = (Uint32)c->p[0] | ((Uint32)c->p[1] << 8) |
+		((Uint32)c->p[2] << 16) | ((Uint32)c->p[3] << 24);
+	c->p += 4;
+	c->left -= 4;
+	return v;
+}
+
+static Sint64 cursor_le64(struct font_index_cursor *c)
+{
+	Uint64 lo = cursor_le32(c);
+	Uint64 hi = cursor_le32(c);
+
+	return (Sint64)(lo | (hi << 32));
+}
+
+/**
+ * Reads a string prefixed by its length. An empty string is read as NULL.
+ */
+static char *cursor_str(struct font_index_cursor *c)
+{
+	size_t len;
+	char *str;
+
+	if(c->left < 2)
+	{
+		c->ok = SDL_FALSE;
+		return NULL;
+	}
+
+	len = (size_t)c->p[0] | ((size_t)c->p[1] << 8);
+	c->p += 2;
+	c->left -= 2;
+	if(len == 0)
+		return NULL;
+
+	if(c->left < len)
+	{
+		c->ok = SDL_FALSE;
+		return NULL;
+	}
+
+	str = SDL_malloc(len + 1);
+	if(str == NULL)
+	{
+		c->ok = SDL_FALSE;
+		return NULL;
+	}
+
+	SDL_memcpy(str, c->p, len);
+	str[len] = '\0';
+	c->p += len;
+	c->left -= len;
+	return str;
+}
+
+static void write_str(SDL_RWops *rw, const char *str)
+{
+	size_t len = str != NULL ? SDL_strlen(str) : 0;
+
+	len = SDL_min(len, 0xFFFF);
+	SDL_WriteLE16(rw, (Uint16)len);
+	if(len > 0)
+		SDL_RWwrite(rw, str, len, 1);
+}
+
+static int font_index_entry_cmp(const void *a, const void *b)
+{
+	const struct font_index_entry *ea = a, *eb = b;
+
+	return SDL_strcmp(ea->path, eb->path);
+}
+
+/**
+ * Loads the index saved by a previous session.
+ *
+ * \return	0 on success, or -1 if the index could not be loaded.
+ */
+static int font_index_load(font_index_s *idx)
+{
+	struct font_index_cursor c;
+	Uint8 *file;
+	size_t file_sz;
+	Uint32 dir_count, entry_count;
+
+	file = SDL_LoadFile(idx->path, &file_sz);
+	if(file == NULL)
+	{
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+			"No font index loaded from '%s': %s",
+			idx->path, SDL_GetError());
+		return -1;
+	}
+
+	c.p = file;
+	c.left = file_sz;
+	c.ok = SDL_TRUE;
+
+	if(cursor_le32(&c) != FONT_INDEX_MAGIC ||
+		cursor_le32(&c) != FONT_INDEX_VERSION)
+	{
+		SDL_LogInfo(HAIYAJAN_LOG_CATEGORY_FONT,
+			"Ignoring incompatible font index '%s'", idx->path);
+		goto err;
+	}
+
+	dir_count = cursor_le32(&c);
+	entry_count = cursor_le32(&c);
+	if(dir_count > FONT_INDEX_MAX_RECORDS ||
+		entry_count > FONT_INDEX_MAX_RECORDS)
+		goto corrupt;
+
+	for(Uint32 i = 0; i < dir_count && c.ok == SDL_TRUE; i++)
+	{
+		struct font_index_dir d;
+
+		d.mtime = cursor_le64(&c);
+		d.path = cursor_str(&c);
+		if(d.path == NULL)
+			goto corrupt;
+
+		stb_arr_push(idx->dirs, d);
+	}
+
+	for(Uint32 i = 0; i < entry_count && c.ok == SDL_TRUE; i++)
+	{
+		struct font_index_entry e = { 0 };
+
+		e.mtime = cursor_le64(&c);
+		e.size = cursor_le64(&c);
+		for(unsigned w = 0; w < FONT_INDEX_BLOCK_WORDS; w++)
+			e.blocks[w] = cursor_le32(&c);
+
+		e.path = cursor_str(&c);
+		e.family = cursor_str(&c);
+		e.style = cursor_str(&c);
+		if(e.path == NULL)
+		{
+			SDL_free(e.family);
+			SDL_free(e.style);
+			goto corrupt;
+		}
+
+		stb_arr_push(idx->entries, e);
+	}
+
+	if(c.ok == SDL_FALSE)
+		goto corrupt;
+
+	SDL_free(file);
+	SDL_qsort(idx->entries, stb_arr_len(idx->entries),
+		sizeof(*idx->entries), font_index_entry_cmp);
+	return 0;
+
+corrupt:
+	SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_FONT,
+		"Font index '%s' is corrupt", idx->path);
+err:
+	font_index_free_entries(idx->entries);
+	font_index_free_dirs(idx->dirs);
+	idx->entries = NULL;
+	idx->dirs = NULL;
+	SDL_free(file);
+	return -1;
+}
+
+static void font_index_save(const font_index_s *idx)
+{
+	SDL_RWops *rw;
+
+	if(idx->path == NULL)
+		return;
+
+	rw = SDL_RWFromFile(idx->path, "wb");
+	if(rw == NULL)
+	{
+		SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_FONT,
+			"Unable to save font index: %s", SDL_GetError());
+		return;
+	}
+
+	SDL_WriteLE32(rw, FONT_INDEX_MAGIC);
+	SDL_WriteLE32(rw, FONT_INDEX_VERSION);
+	SDL_WriteLE32(rw, stb_arr_len(idx->dirs));
+	SDL_WriteLE32(rw, stb_arr_len(idx->entries));
+
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(idx->dirs); i++)
+	{
+		SDL_WriteLE64(rw, (Uint64)idx->dirs[i].mtime);
+		write_str(rw, idx->dirs[i].path);
+	}
+
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(idx->entries); i++)
+	{
+		const struct font_index_entry *e = &idx->entries[i];
+
+		SDL_WriteLE64(rw, (Uint64)e->mtime);
+		SDL_WriteLE64(rw, (Uint64)e->size);
+		for(unsigned w = 0; w < FONT_INDEX_BLOCK_WORDS; w++)
+			SDL_WriteLE32(rw, e->blocks[w]);
+
+		write_str(rw, e->path);
+		write_str(rw, e->family);
+		write_str(rw, e->style);
+	}
+
+	if(SDL_RWclose(rw) != 0)
+	{
+		SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_FONT,
+			"Unable to save font index: %s", SDL_GetError());
+	}
+}
+
+/**
+ * Obtains the directories that fonts are installed to.
+ *
+ * \return	Array of directories, each of which must be freed with
+ *		SDL_free(), and the array with stb_arr_free().
+ */
+static char **font_index_roots(void)
+{
+	char **roots = NULL;
+	const char *home = SDL_getenv("HOME");
+	const char *data = SDL_getenv("XDG_DATA_HOME");
+	char buf[1024];
+
+	stb_arr_push(roots, SDL_strdup("/usr/share/fonts"));
+	stb_arr_push(roots, SDL_strdup("/usr/local/share/fonts"));
+
+	if(data != NULL && *data != '\0')
+	{
+		SDL_snprintf(buf, sizeof(buf), "%s/fonts", data);
+		stb_arr_push(roots, SDL_strdup(buf));
+	}
+	else if(home != NULL)
+	{
+		SDL_snprintf(buf, sizeof(buf), "%s/.local/share/fonts", home);
+		stb_arr_push(roots, SDL_strdup(buf));
+	}
+
+	if(home != NULL)
+	{
+		SDL_snprintf(buf, sizeof(buf), "%s/.fonts", home);
+		stb_arr_push(roots, SDL_strdup(buf));
+	}
+
+	return roots;
+}
+
+static void font_index_free_roots(char **roots)
+{
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(roots); i++)
+		SDL_free(roots[i]);
+
+	stb_arr_free(roots);
+}
+
+/**
+ * Checks whether any font directory has changed since the index was saved.
+ */
+static SDL_bool font_index_is_current(const font_index_s *idx)
+{
+	SDL_bool ret = SDL_TRUE;
+	char **roots;
+
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(idx->dirs); i++)
+	{
+		struct stat st;
+
+		if(stat(idx->dirs[i].path, &st) != 0 ||
+			(Sint64)st.st_mtime != idx->dirs[i].mtime)
+			return SDL_FALSE;
+	}
+
+	/* A font directory may have been created since. */
+	roots = font_index_roots();
+	for(unsigned r = 0; r < (unsigned)stb_arr_len(roots); r++)
+	{
+		SDL_bool found = SDL_FALSE;
+		struct stat st;
+
+		if(roots[r] == NULL || stat(roots[r], &st) != 0)
+			continue;
+
+		for(unsigned i = 0; i < (unsigned)stb_arr_len(idx->dirs); i++)
+		{
+			if(SDL_strcmp(idx->dirs[i].path, roots[r]) == 0)
+			{
+				found = SDL_TRUE;
+				break;
+			}
+		}
+
+		if(found == SDL_FALSE)
+		{
+			ret = SDL_FALSE;
+			break;
+		}
+	}
+
+	font_index_free_roots(roots);
+	return ret;
+}
+
+static const struct font_index_entry *font_index_find_old(
+	const struct font_index_scan *sc, const char *path)
+{
+	int lo = 0, hi = stb_arr_len(sc->old) - 1;
+
+	while(lo <= hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		int cmp = SDL_strcmp(path, sc->old[mid].path);
+
+		if(cmp == 0)
+			return &sc->old[mid];
+
+		if(cmp < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+static void font_index_mark_blocks(void *user, Uint32 first, Uint32 last)
+{
+	Uint32 *blocks = user;
+	int end;
+
+	if(first > FONT_INDEX_LAST_CP)
+		return;
+
+	end = font_index_block(SDL_min(last, FONT_INDEX_LAST_CP));
+	for(int b = font_index_block(first); b <= end; b++)
+		blocks[b / 32] |= 1u << (b % 32);
+}
+
+static void font_index_add_file(struct font_index_scan *sc, const char *path,
+	const struct stat *st)
+{
+	const struct font_index_entry *old;
+	struct font_index_entry e = { 0 };
+
+	e.path = SDL_strdup(path);
+	if(e.path == NULL)
+		return;
+
+	e.mtime = (Sint64)st->st_mtime;
+	e.size = (Sint64)st->st_size;
+
+	/* Fonts that have not changed since the previous scan are not read
+	 * again. */
+	old = font_index_find_old(sc, path);
+	if(old != NULL && old->mtime == e.mtime && old->size == e.size)
+	{
+		SDL_memcpy(e.blocks, old->blocks, sizeof(e.blocks));
+		e.family = old->family != NULL ? SDL_strdup(old->family) : NULL;
+		e.style = old->style != NULL ? SDL_strdup(old->style) : NULL;
+	}
+	else
+	{
+		/* Fonts that cannot be read are still recorded, so that they
+		 * are not read again by the next scan. */
+		SDL_RWops *rw = SDL_RWFromFile(path, "rb");
+		struct sfnt_tables t;
+
+		if(rw != NULL && sfnt_find_tables(rw, &t) == 0 &&
+			sfnt_read_cmap(rw, t.cmap_off, font_index_mark_blocks,
+				e.blocks) == 0)
+		{
+			if(t.name_off != 0)
+			{
+				e.family = sfnt_read_name(rw, t.name_off,
+					SFNT_NAME_FAMILY);
+				e.style = sfnt_read_name(rw, t.name_off,
+					SFNT_NAME_STYLE);
+			}
+
+			/* The family is used to mark readable fonts. */
+			if(e.family == NULL)
+			{
+				const char *base = SDL_strrchr(path, '/');
+				e.family = SDL_strdup(base + 1);
+			}
+		}
+
+		if(rw != NULL)
+			SDL_RWclose(rw);
+
+		sc->read++;
+	}
+
+	stb_arr_push(sc->entries, e);
+}
+
+static SDL_bool font_index_is_font(const char *name)
+{
+	size_t len = SDL_strlen(name);
+
+	if(len < 4)
+		return SDL_FALSE;
+
+	name += len - 4;
+	return SDL_strcasecmp(name, ".ttf") == 0 ||
+		SDL_strcasecmp(name, ".otf") == 0 ||
+		SDL_strcasecmp(name, ".ttc") == 0 ? SDL_TRUE : SDL_FALSE;
+}
+
+static void font_index_scan_dir(struct font_index_scan *sc, const char *dir,
+	unsigned depth)
+{
+	struct font_index_dir d;
+	struct dirent *de;
+	struct stat st;
+	DIR *dp;
+
+	if(depth > FONT_INDEX_MAX_DEPTH || stat(dir, &st) != 0 ||
+		S_ISDIR(st.st_mode) == 0)
+		return;
+
+	dp = opendir(dir);
+	if(dp == NULL)
+		return;
+
+	d.path = SDL_strdup(dir);
+	d.mtime = (Sint64)st.st_mtime;
+	if(d.path != NULL)
+		stb_arr_push(sc->dirs, d);
+
+	while((de = readdir(dp)) != NULL)
+	{
+		size_t len;
+		char *path;
+
+		/* Skips this and the parent directory, and hidden files such
+		 * as fontconfig caches. */
+		if(de->d_name[0] == '.')
+			continue;
+
+		len = SDL_strlen(dir) + SDL_strlen(de->d_name) + 2;
+		path = SDL_malloc(len);
+		if(path == NULL)
+			break;
+
+		SDL_snprintf(path, len, "%s/%s", dir, de->d_name);
+		if(stat(path, &st) == 0)
+		{
+			if(S_ISDIR(st.st_mode))
+				font_index_scan_dir(sc, path, depth + 1);
+			else if(S_ISREG(st.st_mode) &&
+				font_index_is_font(de->d_name) == SDL_TRUE)
+				font_index_add_file(sc, path, &st);
+		}
+
+		SDL_free(path);
+	}
+
+	closedir(dp);
+}
+
+/**
+ * Scans font directories, replacing the fonts within the index.
+ */
+static int font_index_scan_main(void *data)
+{
+	font_index_s *idx = data;
+	struct font_index_scan sc = { 0 };
+	const Uint32 start_ms = SDL_GetTicks();
+	char **roots;
+
+	sc.old = idx->entries;
+
+	roots = font_index_roots();
+	for(unsigned r = 0; r < (unsigned)stb_arr_len(roots); r++)
+	{
+		if(roots[r] != NULL)
+			font_index_scan_dir(&sc, roots[r], 0);
+	}
+	font_index_free_roots(roots);
+
+	SDL_qsort(sc.entries, stb_arr_len(sc.entries), sizeof(*sc.entries),
+		font_index_entry_cmp);
+
+	font_index_free_entries(idx->entries);
+	font_index_free_dirs(idx->dirs);
+	idx->entries = sc.entries;
+	idx->dirs = sc.dirs;
+
+	font_index_save(idx);
+
+	SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+		"Indexed %d fonts (%u read) in %d directories in %u ms",
+		stb_arr_len(idx->entries), sc.read, stb_arr_len(idx->dirs),
+		SDL_GetTicks() - start_ms);
+
+	SDL_AtomicSet(&idx->ready, 1);
+	return 0;
+}
+#endif
+
+font_index_s *font_index_open(const char *path)
+{
+#ifdef FONT_INDEX_SCAN
+	font_index_s *idx;
+
+	idx = SDL_calloc(1, sizeof(*idx));
+	if(idx == NULL)
+		return NULL;
+
+	if(path != NULL)
+		idx->path = SDL_strdup(path);
+
+	if(idx->path != NULL && font_index_load(idx) == 0 &&
+		font_index_is_current(idx) == SDL_TRUE)
+	{
+		SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_FONT,
+			"Loaded index of %d fonts from '%s'",
+			stb_arr_len(idx->entries), idx->path);
+		SDL_AtomicSet(&idx->ready, 1);
+		return idx;
+	}
+
+	/* Scanning may take seconds on systems with many fonts, during which
+	 * only the built-in fonts are used. */
+	idx->scan = SDL_CreateThread(font_index_scan_main, "font_index", idx);
+	if(idx->scan == NULL)
+	{
+		SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_FONT,
+			"Unable to scan fonts in the background: %s",
+			SDL_GetError());
+		font_index_scan_main(idx);
+	}
+
+	return idx;
+#else
+	(void)path;
+	return NULL;
+#endif
+}
+
+void font_index_close(font_index_s *idx)
+{
+	if(idx == NULL)
+		return;
+
+	if(idx->scan != NULL)
+		SDL_WaitThread(idx->scan, NULL);
+
+	font_index_free_entries(idx->entries);
+	font_index_free_dirs(idx->dirs);
+	stb_arr_free(idx->missed);
+	SDL_free(idx->path);
+	SDL_free(idx);
+}
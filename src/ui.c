@@ -86,8 +86,79 @@ struct ui_ctx {
 	} padding;
 
 	Uint32 ref_tile_size;
+
+	/* Width of the window available to labels. Labels that are wider are
+	 * truncated to fit. */
+	int label_w;
+
+	/* Point sizes and DPI that fonts are currently rendered at. */
+	struct ui_font_size {
+		int pt[FONT_STYLE_MAX];
+		unsigned hdpi, vdpi;
+	} font_size;
+
+	/* Set whilst the members of a dynamic element are drawn. */
+	SDL_bool drawing_dynamic;
+
+	/* Whether labels and icons are drawn from scaled glyphs rather than
+	 * from cached bitmaps. Set by UI_HINT_SCALED_GLYPHS. */
+	SDL_bool scaled_glyphs;
+
+	/* Whether labels being rendered in the background are drawn from low
+	 * quality drafts. Set by UI_HINT_PROGRESSIVE_TEXT. */
+	SDL_bool progressive_text;
+
+	/* Performance counter value after which no further drafts are
+	 * rendered in the current frame. Drafts that are not rendered in time
+	 * are drawn as placeholders. */
+	Uint64 draft_deadline;
+
+	/* Time that cache statistics were last logged. */
+	Uint32 stats_logged_ms;
+
+	/* Progress of rendering menus that may be opened next into the cache.
+	 * Reset whenever the current menu or selection changes. */
+	struct {
+		/* Number of candidate menus that have been prefetched. */
+		unsigned menus_done;
+		/* Next element to prefetch within the current candidate. */
+		const struct ui_element *next;
+		SDL_bool complete;
+	} prefetch;
+
+	/* Bitmaps that are being rendered in the background, and the
+	 * elements that are waiting for them. An element is drawn as a
+	 * placeholder until its bitmap is ready. */
+	struct ui_pending {
+		Uint64 content_key;
+		const struct ui_element *el;
+		ui_texture_part_e part;
+		Hash label_hash;
+		/* Set if requested whilst installed fonts were being
+		 * discovered, in which case the bitmap is not saved to the
+		 * texture pack. */
+		SDL_bool provisional;
+	} *pending;
+
+	/* Content keys of bitmaps that failed to render at the current font
+	 * sizes, so that they are not rendered again on every frame. */
+	Uint64 *failed;
 };
 
+/* Maximum time spent prefetching menus in an idle frame. */
+#define UI_PREFETCH_BUDGET_MS 2
+
+/* Maximum time spent rendering low quality drafts of labels in a frame. */
+#define UI_DRAFT_BUDGET_MS 4
+
+/* Interval between logging cache statistics. Statistics are only logged if
+ * the priority of the cache log category is verbose. */
+#define UI_CACHE_STATS_INTERVAL_MS 10000
+
+/* Name of the file within the user's preference directory that rendered
+ * bitmaps are saved to. */
+#define UI_TEXTURE_PACK_FILENAME "textures.hypk"
+
 typedef enum {
 	/* Go back to the previous item.
 	 * Could be used when user presses UP. */
@@ -260,7 +331,17 @@ out:
 	return;
 }
 
+/**
+ * Restarts prefetching, from the menu opened by the selected element.
+ */
 HEDLEY_NON_NULL(1)
+static void ui_prefetch_reset(ui_ctx_s *ctx)
+{
+	ctx->prefetch.menus_done = 0;
+	ctx->prefetch.next = NULL;
+	ctx->prefetch.complete = SDL_FALSE;
+}
+
 static void ui_input(ui_ctx_s *ctx, menu_instruction_e instr)
 {
 	switch(instr)
@@ -324,6 +405,7 @@ static void ui_input(ui_ctx_s *ctx, menu_instruction_e instr)
 	}
 
 	ctx->redraw = SDL_TRUE;
+	ui_prefetch_reset(ctx);
 	SDL_LogDebug(SDL_LOG_CATEGORY_VIDEO, "Selected item %s '%s'",
 			elem_type_str[ctx->selected->type],
 			ctx->selected->label);
@@ -337,6 +419,7 @@ static void ui_resize_all(ui_ctx_s *ui, int win_w, int win_h)
 	const float header_size_ref = 28.0f;
 	const float regular_size_ref = 16.0f;
 	const int win_min = win_w < win_h ? win_w : win_h;
+	const struct ui_font_size prev_size = ui->font_size;
 	int icon_pt, header_pt, regular_pt;
 
 	SDL_assert(ui->dpi > 0.0f);
@@ -367,13 +450,16 @@ static void ui_resize_all(ui_ctx_s *ui, int win_w, int win_h)
 	header_pt = (int)(header_size_ref);
 	regular_pt = (int)(regular_size_ref);
 
+	ui->font_size.pt[FONT_STYLE_ICON] = icon_pt;
+	ui->font_size.pt[FONT_STYLE_HEADER] = header_pt;
+	ui->font_size.pt[FONT_STYLE_REGULAR] = regular_pt;
+	ui->font_size.hdpi = ui->hdpi;
+	ui->font_size.vdpi = ui->vdpi;
+
 	SDL_assert(ui->font != NULL);
-	font_change_pt(ui->font,
-		       (unsigned) ((float) ui->hdpi),
-		       (unsigned) ((float) ui->vdpi),
-		       icon_pt, header_pt, regular_pt);
 	do {
-		int font_h = font_get_height(ui->font, FONT_STYLE_HEADER);
+		int font_h = font_get_height_at(ui->font, FONT_STYLE_HEADER,
+			header_pt, ui->vdpi);
 		float font_mult;
 
 		/* Header should be less than half the size of a tile. */
@@ -385,13 +471,35 @@ static void ui_resize_all(ui_ctx_s *ui, int win_w, int win_h)
 		SDL_LogDebug(SDL_LOG_CATEGORY_VIDEO,
 			     "Font height is %d, setting font size multiplier to %f",
 			     font_h, font_mult);
-		font_change_pt(ui->font,
-			       (unsigned) ((float) ui->hdpi * font_mult),
-			       (unsigned) ((float) ui->vdpi * font_mult),
-			       icon_pt, header_pt, regular_pt);
+		ui->font_size.hdpi = (unsigned) ((float) ui->hdpi * font_mult);
+		ui->font_size.vdpi = (unsigned) ((float) ui->vdpi * font_mult);
 	} while(0);
 
-	clear_cached_textures(ui->cache);
+	/* The fonts are set to their final size at once, so that fonts are
+	 * not resized and glyphs are not rasterised at an unused size. */
+	font_change_pt(ui->font, ui->font_size.hdpi, ui->font_size.vdpi,
+		       icon_pt, header_pt, regular_pt);
+
+	/* Elements are drawn with a margin of an eighth of the window on the
+	 * left, and labels are given the same margin on the right. */
+	ui->label_w = win_w - 2 * (win_w / 8);
+
+	/* Bitmaps rendered at previous font sizes are kept in the cache, as
+	 * the window may be moved back to a monitor with the previous DPI.
+	 * Entries of labels that are truncated to the width of the window are
+	 * replaced as their content key changes with the width. */
+	set_cached_texture_generation(ui->cache,
+		(Uint32)HASH_FN(&ui->font_size, sizeof(ui->font_size), 0));
+	ui_prefetch_reset(ui);
+
+	/* Background renders at previous font sizes are no longer awaited by
+	 * any element. Bitmaps that failed to render may fit at the new
+	 * sizes. Both are kept if only the width of the window changed. */
+	if(SDL_memcmp(&prev_size, &ui->font_size, sizeof(prev_size)) != 0)
+	{
+		stb_arr_setlen(ui->pending, 0);
+		stb_arr_setlen(ui->failed, 0);
+	}
 }
 
 HEDLEY_NON_NULL(1,2)
@@ -497,9 +605,11 @@ void ui_process_event(ui_ctx_s *HEDLEY_RESTRICT ctx, SDL_Event *HEDLEY_RESTRICT
 			new_w = e->window.data1;
 			new_h = e->window.data2;
 
-			new_tex = SDL_CreateTexture(ren, texture_format,
-				SDL_TEXTUREACCESS_TARGET,
-				new_w, new_h);
+			/* Render targets are recycled, so that repeatedly
+			 * resizing between the same sizes does not create new
+			 * textures each time. */
+			new_tex = acquire_target_texture(ctx->cache, ren,
+				texture_format, new_w, new_h);
 			if(new_tex == NULL)
 			{
 				SDL_LogDebug(SDL_LOG_CATEGORY_VIDEO,
@@ -508,20 +618,20 @@ void ui_process_event(ui_ctx_s *HEDLEY_RESTRICT ctx, SDL_Event *HEDLEY_RESTRICT
 				return;
 			}
 
-			new_static_tex = SDL_CreateTexture(ren, texture_format,
-				SDL_TEXTUREACCESS_TARGET,
-				new_w, new_h);
+			new_static_tex = acquire_target_texture(ctx->cache,
+				ren, texture_format, new_w, new_h);
 			if(new_static_tex == NULL)
 			{
 				SDL_LogDebug(SDL_LOG_CATEGORY_VIDEO,
 					"Unable to create new texture for "
 					"static elements: %s",
 					SDL_GetError());
+				recycle_target_texture(ctx->cache, new_tex);
 				return;
 			}
 
-			SDL_DestroyTexture(ctx->tex);
-			SDL_DestroyTexture(ctx->static_tex);
+			recycle_target_texture(ctx->cache, ctx->tex);
+			recycle_target_texture(ctx->cache, ctx->static_tex);
 			ctx->tex = new_tex;
 			ctx->static_tex = new_static_tex;
 
@@ -563,6 +673,7 @@ void ui_process_event(ui_ctx_s *HEDLEY_RESTRICT ctx, SDL_Event *HEDLEY_RESTRICT
 			{
 				ctx->redraw = SDL_TRUE;
 				ctx->selected = this_box->ui_element;
+				ui_prefetch_reset(ctx);
 				SDL_LogDebug(SDL_LOG_CATEGORY_INPUT,
 					"Selected item '%s' using motion",
 					ctx->selected->label);
@@ -599,6 +710,7 @@ void ui_process_event(ui_ctx_s *HEDLEY_RESTRICT ctx, SDL_Event *HEDLEY_RESTRICT
 			{
 				ctx->redraw = SDL_TRUE;
 				ctx->selected = this_box->ui_element;
+				ui_prefetch_reset(ctx);
 				SDL_LogDebug(SDL_LOG_CATEGORY_INPUT,
 					"Selected item '%s' using button",
 					ctx->selected->label);
@@ -736,6 +848,378 @@ static void ui_draw_selection(ui_ctx_s *HEDLEY_RESTRICT ctx,
 	return;
 }
 
+/**
+ * Calculates a key identifying the content of a rendered bitmap. The key
+ * depends only on the content of the bitmap and the parameters it is rendered
+ * with, so that elements with the same content share a single bitmap, and so
+ * that the key remains valid within the texture pack after the application is
+ * restarted.
+ */
+HEDLEY_NON_NULL(1,2)
+static Uint64 ui_content_key(const ui_ctx_s *HEDLEY_RESTRICT ctx,
+	const struct ui_element *HEDLEY_RESTRICT el,
+	ui_texture_part_e part, font_style_e style, SDL_Colour fg, int max_w)
+{
+	struct {
+		Uint32 part, style;
+		Sint32 pt;
+		Uint32 hdpi, vdpi;
+		Sint32 max_w;
+		Uint8 fg[4];
+	} k;
+	Uint64 seed;
+
+	SDL_zero(k);
+	k.part = part;
+	k.style = style;
+	k.pt = ctx->font_size.pt[style];
+	k.hdpi = ctx->font_size.hdpi;
+	k.vdpi = ctx->font_size.vdpi;
+	k.max_w = max_w;
+	k.fg[0] = fg.r;
+	k.fg[1] = fg.g;
+	k.fg[2] = fg.b;
+	k.fg[3] = fg.a;
+	seed = wyhash64(&k, sizeof(k), 0);
+
+	if(part == UI_TEXTURE_PART_ICON)
+	{
+		return wyhash64(&el->elem.tile.icon,
+			sizeof(el->elem.tile.icon), seed);
+	}
+
+	return wyhash64(el->label, SDL_strlen(el->label), seed);
+}
+
+/**
+ * Obtains the width that the label of an element is truncated to. Labels that
+ * fit within the window are not truncated, so that their bitmaps do not depend
+ * on the size of the window.
+ *
+ * \return	Width to truncate the label to, or 0 if it is not truncated.
+ */
+HEDLEY_NON_NULL(1,2)
+static int ui_label_max_w(ui_ctx_s *HEDLEY_RESTRICT ctx,
+	const struct ui_element *HEDLEY_RESTRICT el, font_style_e style)
+{
+	int avail = ctx->label_w;
+	int w;
+
+	/* Labels of tiles are placed to the right of the tile. */
+	if(el->type == UI_ELEM_TYPE_TILE)
+		avail -= (int)ctx->ref_tile_size + ctx->padding.tile;
+
+	if(avail <= 0 ||
+		font_measure_text(ctx->font, el->label, style, &w, NULL) != 0 ||
+		w <= avail)
+		return 0;
+
+	return avail;
+}
+
+/**
+ * Whether the bitmap with the given content key failed to render at the
+ * current font sizes.
+ */
+HEDLEY_NON_NULL(1)
+static SDL_bool ui_render_failed(const ui_ctx_s *ctx, Uint64 content_key)
+{
+	for(int i = 0; i < stb_arr_len(ctx->failed); i++)
+	{
+		if(ctx->failed[i] == content_key)
+			return SDL_TRUE;
+	}
+
+	return SDL_FALSE;
+}
+
+/**
+ * Requests that the label or icon of an element is rendered in the background.
+ * The bitmap is stored in the cache by ui_collect_renders() once it is ready.
+ *
+ * \return	0 on success, or -1 if the bitmap must be rendered immediately.
+ */
+HEDLEY_NON_NULL(1,2)
+static int ui_render_async(ui_ctx_s *HEDLEY_RESTRICT ctx,
+	const struct ui_element *HEDLEY_RESTRICT el,
+	ui_texture_part_e part, font_style_e style, SDL_Colour fg,
+	Hash label_hash, Uint64 content_key, int max_w)
+{
+	struct ui_pending pd;
+	SDL_bool requested = SDL_FALSE;
+
+	for(unsigned i = 0; i < (unsigned)stb_arr_len(ctx->pending); i++)
+	{
+		const struct ui_pending *cmp = &ctx->pending[i];
+
+		if(cmp->content_key != content_key)
+			continue;
+
+		/* This element is already waiting for the bitmap. */
+		if(cmp->el == el && cmp->part == part)
+			return 0;
+
+		requested = SDL_TRUE;
+	}
+
+	/* Elements with the same content share a single request. */
+	if(requested == SDL_FALSE)
+	{
+		int ret;
+
+		if(part == UI_TEXTURE_PART_ICON)
+			ret = font_render_icon_async(ctx->font, content_key,
+				el->elem.tile.icon, fg);
+		else
+			ret = font_render_text_async(ctx->font, content_key,
+				el->label, style, FONT_QUALITY_HIGH, fg, max_w);
+
+		if(ret != 0)
+			return -1;
+	}
+
+	pd.content_key = content_key;
+	pd.el = el;
+	pd.part = part;
+	pd.label_hash = label_hash;
+	pd.provisional = font_discovery_pending(ctx->font);
+	stb_arr_push(ctx->pending, pd);
+
+	return 0;
+}
+
+/**
+ * Stores bitmaps that have been rendered in the background, and redraws the
+ * user interface so that they replace their placeholders.
+ */
+HEDLEY_NON_NULL(1)
+static void ui_collect_renders(ui_ctx_s *ctx)
+{
+	Uint64 content_key;
+	SDL_Surface *surf;
+
+	while(font_collect_render(ctx->font, &content_key, &surf) == 1)
+	{
+		SDL_bool stored = SDL_FALSE;
+		SDL_bool provisional = font_discovery_pending(ctx->font);
+
+		if(surf == NULL)
+			stb_arr_push(ctx->failed, content_key);
+
+		for(unsigned i = 0; i < (unsigned)stb_arr_len(ctx->pending);)
+		{
+			const struct ui_pending *pd = &ctx->pending[i];
+			SDL_Rect src;
+
+			if(pd->content_key != content_key)
+			{
+				i++;
+				continue;
+			}
+
+			/* The bitmap is shared with the other elements waiting
+			 * for it, replacing any drafts that they are drawn
+			 * from. */
+			if(surf != NULL && stored == SDL_FALSE)
+			{
+				store_cached_surface(ctx->cache, pd->part,
+					pd->label_hash, pd->el, content_key,
+					surf, &src);
+				stored = SDL_TRUE;
+			}
+			else if(surf != NULL)
+			{
+				get_shared_texture(ctx->cache, pd->part,
+					pd->label_hash, pd->el, content_key,
+					&src);
+			}
+
+			if(pd->provisional == SDL_TRUE)
+				provisional = SDL_TRUE;
+
+			stb_arr_fastdelete(ctx->pending, i);
+		}
+
+		/* Text rendered before installed fonts were discovered may be
+		 * missing glyphs, so is not saved for future sessions. */
+		if(surf != NULL && provisional == SDL_FALSE)
+			store_packed_surface(ctx->cache, content_key, surf);
+
+		/* Elements whose bitmap failed to render are not requested
+		 * again until font sizes change. */
+		if(surf != NULL)
+			ctx->redraw = SDL_TRUE;
+
+		SDL_FreeSurface(surf);
+	}
+}
+
+/**
+ * Obtains a low quality draft of a label that is being rendered in the
+ * background. The draft is cached for the element, and is replaced by the
+ * high quality bitmap in ui_collect_renders(). Drafts are neither shared with
+ * the high quality bitmap nor saved to the texture pack.
+ *
+ * \param content_key	Key of the high quality bitmap.
+ * \param max_w	Width that the label is truncated to.
+ * \return	Texture holding the draft, or NULL if the time budget for
+ *		drafts within this frame is exhausted or on error.
+ */
+HEDLEY_NON_NULL(1,2,7)
+static SDL_Texture *ui_get_draft_texture(ui_ctx_s *HEDLEY_RESTRICT ctx,
+	const struct ui_element *HEDLEY_RESTRICT el,
+	ui_texture_part_e part, font_style_e style, SDL_Colour fg,
+	Hash label_hash, SDL_Rect *HEDLEY_RESTRICT src, Uint64 content_key,
+	int max_w)
+{
+	const Uint64 draft_key = wyhash64(&content_key, sizeof(content_key),
+		FONT_QUALITY_LOW);
+	SDL_Texture *tex;
+	SDL_Surface *surf;
+
+	/* Elements with the same content share a single draft. */
+	tex = get_shared_texture(ctx->cache, part, label_hash, el, draft_key,
+		src);
+	if(tex != NULL)
+		return tex;
+
+	if(SDL_GetPerformanceCounter() >= ctx->draft_deadline)
+		return NULL;
+
+	surf = font_render_text(ctx->font, el->label, style, FONT_QUALITY_LOW,
+		fg, max_w);
+	if(surf == NULL)
+		return NULL;
+
+	tex = store_cached_surface(ctx->cache, part, label_hash, el,
+		draft_key, surf, src);
+	SDL_FreeSurface(surf);
+	return tex;
+}
+
+/**
+ * Obtains the texture holding the rendered label or icon of an element. The
+ * bitmap is taken from the cache if possible, either from the entry of this
+ * element or from another element with the same content. Otherwise it is
+ * taken from the texture pack, or is rendered. Bitmaps of elements that are
+ * not dynamic are rendered in the background if possible.
+ *
+ * \param ctx	UI context.
+ * \param el	UI element parameters.
+ * \param src	Set to the location of the bitmap within the returned texture.
+ *		If NULL is returned because the bitmap is being rendered in
+ *		the background, set to the estimated size of the bitmap.
+ *		Otherwise, set to zero on error.
+ * \return	Texture holding the bitmap, or NULL if the bitmap is not
+ *		available.
+ */
+HEDLEY_NON_NULL(1,2,7)
+static SDL_Texture *ui_get_part_texture(ui_ctx_s *HEDLEY_RESTRICT ctx,
+	const struct ui_element *HEDLEY_RESTRICT el,
+	ui_texture_part_e part, font_style_e style, SDL_Colour fg,
+	Hash label_hash, SDL_Rect *HEDLEY_RESTRICT src)
+{
+	SDL_Texture *tex;
+	SDL_Surface *surf = NULL;
+	Uint64 content_key;
+	int max_w = 0;
+
+	if(part == UI_TEXTURE_PART_LABEL)
+		max_w = ui_label_max_w(ctx, el, style);
+
+	content_key = ui_content_key(ctx, el, part, style, fg, max_w);
+	tex = get_cached_texture(ctx->cache, part, label_hash, el,
+		content_key, src);
+	if(tex != NULL)
+		return tex;
+
+	tex = get_shared_texture(ctx->cache, part, label_hash, el,
+		content_key, src);
+	if(tex != NULL)
+		return tex;
+
+	if(ui_render_failed(ctx, content_key) == SDL_TRUE)
+	{
+		SDL_zerop(src);
+		return NULL;
+	}
+
+	/* Dynamic elements are expected to change often, so they are not
+	 * saved to the texture pack. */
+	if(ctx->drawing_dynamic == SDL_FALSE)
+		surf = get_packed_surface(ctx->cache, content_key);
+
+	if(surf == NULL && ctx->drawing_dynamic == SDL_FALSE &&
+		ui_render_async(ctx, el, part, style, fg, label_hash,
+			content_key, max_w) == 0)
+	{
+		if(ctx->progressive_text == SDL_TRUE &&
+			part == UI_TEXTURE_PART_LABEL)
+		{
+			tex = ui_get_draft_texture(ctx, el, part, style, fg,
+				label_hash, src, content_key, max_w);
+			if(tex != NULL)
+				return tex;
+		}
+
+		/* Estimate the size of the bitmap so that a placeholder can be
+		 * drawn in its place. */
+		src->x = 0;
+		src->y = 0;
+		src->h = font_get_height(ctx->font, style);
+		if(part == UI_TEXTURE_PART_ICON)
+			src->w = src->h;
+		else if(font_measure_text(ctx->font, el->label, style,
+				&src->w, &src->h) != 0)
+			src->w = (int)SDL_strlen(el->label) * src->h / 2;
+
+		if(max_w != 0)
+			src->w = SDL_min(src->w, max_w);
+
+		return NULL;
+	}
+
+	if(surf == NULL)
+	{
+		if(part == UI_TEXTURE_PART_ICON)
+			surf = font_render_icon(ctx->font, el->elem.tile.icon, fg);
+		else
+			surf = font_render_text(ctx->font, el->label, style,
+				FONT_QUALITY_HIGH, fg, max_w);
+
+		if(surf == NULL)
+		{
+			stb_arr_push(ctx->failed, content_key);
+			SDL_zerop(src);
+			return NULL;
+		}
+
+		if(ctx->drawing_dynamic == SDL_FALSE &&
+			font_discovery_pending(ctx->font) == SDL_FALSE)
+			store_packed_surface(ctx->cache, content_key, surf);
+	}
+
+	tex = store_cached_surface(ctx->cache, part, label_hash, el,
+		content_key, surf, src);
+	SDL_FreeSurface(surf);
+
+	if(tex == NULL)
+		SDL_zerop(src);
+
+	return tex;
+}
+
+/**
+ * Draws a translucent box in place of a bitmap that is being rendered.
+ */
+HEDLEY_NON_NULL(1,2)
+static void ui_draw_placeholder(ui_ctx_s *HEDLEY_RESTRICT ctx,
+	const SDL_Rect *HEDLEY_RESTRICT dim)
+{
+	SDL_SetRenderDrawColor(ctx->ren, 0xFF, 0xFF, 0xFF, 0x20);
+	SDL_RenderFillRect(ctx->ren, dim);
+}
+
 /**
  * Draw label element 'el' at point 'p'.
  *
@@ -749,30 +1233,43 @@ static void ui_draw_label(ui_ctx_s *HEDLEY_RESTRICT ctx,
 	SDL_Point *HEDLEY_RESTRICT p, unsigned seed)
 {
 	SDL_Texture *label_tex;
+	SDL_Rect src;
 	SDL_Rect dim = {
 		.x = p->x, .y = p->y
 	};
 	Hash label_hash;
 
+	/* Dynamic labels change often, so they are drawn from cached glyphs
+	 * rather than being rendered and cached as a whole. */
+	if((ctx->drawing_dynamic == SDL_TRUE ||
+			ctx->scaled_glyphs == SDL_TRUE) &&
+		font_draw_text(ctx->font, el->label, el->elem.label.style,
+			text_colour_light, p->x, p->y, &dim) == 0)
+	{
+		p->y += dim.h + ctx->padding.label;
+		return;
+	}
+
 	/* Render text. */
 	label_hash = HASH_FN(el->label, SDL_strlen(el->label), seed);
-	label_tex = get_cached_texture(ctx->cache, UI_TEXTURE_PART_LABEL,
-		label_hash, el);
+	label_tex = ui_get_part_texture(ctx, el, UI_TEXTURE_PART_LABEL,
+		el->elem.label.style, text_colour_light, label_hash, &src);
+	if(label_tex == NULL && src.h == 0)
+		return;
+
+	dim.w = src.w;
+	dim.h = src.h;
 	if(label_tex == NULL)
 	{
-		label_tex = font_render_text(ctx->font, el->label,
-			el->elem.label.style, FONT_QUALITY_HIGH,
-			text_colour_light);
-		if(label_tex == NULL)
-			return;
-
-		/* FIXME: Missing checks. */
-		store_cached_texture(ctx->cache, UI_TEXTURE_PART_LABEL,
-			label_hash, el, label_tex);
+		ui_draw_placeholder(ctx, &dim);
+	}
+	else
+	{
+		/* The atlas texture may have been tinted by a previous
+		 * tile. */
+		SDL_SetTextureColorMod(label_tex, 0xFF, 0xFF, 0xFF);
+		SDL_RenderCopy(ctx->ren, label_tex, &src, &dim);
 	}
-
-	SDL_QueryTexture(label_tex, NULL, NULL, &dim.w, &dim.h);
-	SDL_RenderCopy(ctx->ren, label_tex, NULL, &dim);
 
 	/* Increment coordinates to next element. */
 	p->y += dim.h + ctx->padding.label;
@@ -780,6 +1277,93 @@ static void ui_draw_label(ui_ctx_s *HEDLEY_RESTRICT ctx,
 	return;
 }
 
+/**
+ * Positions the label of a tile according to its label placement.
+ *
+ * \param p		The top left point of the tile.
+ * \param len		Size of the tile.
+ * \param pad		Padding between the tile and its label.
+ * \param text_dim	Dimensions of the label. The position is set from the
+ *			height.
+ */
+HEDLEY_NON_NULL(1,2,5)
+static void ui_place_tile_label(const struct ui_element *HEDLEY_RESTRICT el,
+	const SDL_Point *HEDLEY_RESTRICT p, int len, int pad,
+	SDL_Rect *HEDLEY_RESTRICT text_dim)
+{
+	switch(el->elem.tile.label_placement)
+	{
+	case LABEL_PLACEMENT_OUTSIDE_RIGHT_TOP:
+		text_dim->x = p->x + len + pad;
+		text_dim->y = p->y;
+		break;
+
+	case LABEL_PLACEMENT_OUTSIDE_RIGHT_MIDDLE:
+		text_dim->x = p->x + len + pad;
+		text_dim->y = p->y + (len / 2) - (text_dim->h / 2);
+		break;
+
+	case LABEL_PLACEMENT_OUTSIDE_RIGHT_BOTTOM:
+		text_dim->x = p->x + len + pad;
+		text_dim->y = p->y + len - text_dim->h;
+		break;
+
+	default:
+		HEDLEY_UNREACHABLE();
+		break;
+	}
+}
+
+/**
+ * Draws the icon of a tile from its cached bitmap.
+ *
+ * \param ctx	UI context.
+ * \param el	UI element parameters.
+ * \param dim	Dimensions of the tile.
+ */
+HEDLEY_NON_NULL(1,2,3)
+static void ui_draw_tile_icon(ui_ctx_s *HEDLEY_RESTRICT ctx,
+		const struct ui_element *HEDLEY_RESTRICT el,
+		const SDL_Rect *HEDLEY_RESTRICT dim, unsigned seed)
+{
+	SDL_Texture *icon_tex;
+	SDL_Rect icon_src = { 0 };
+	SDL_Rect icon_dim;
+	Hash label_hash;
+
+	label_hash = HASH_FN(&el->elem.tile.icon,
+		sizeof(el->elem.tile.icon), seed);
+	/* Icons are rendered in white and tinted when drawn, as labels are,
+	 * so that a single bitmap serves tiles of any colour. */
+	icon_tex = ui_get_part_texture(ctx, el, UI_TEXTURE_PART_ICON,
+		FONT_STYLE_ICON, text_colour_light, label_hash, &icon_src);
+	icon_dim.w = icon_src.w;
+	icon_dim.h = icon_src.h;
+
+	/* If the icon texture is larger than the tile itself (due to the
+	 * cached icon being high resolution) then resize the icon until it
+	 * fits within the tile. */
+	while(icon_dim.w + ctx->padding.tile >= dim->w)
+	{
+		icon_dim.w /= 2;
+		icon_dim.h /= 2;
+	}
+	icon_dim.x = dim->x + (dim->w / 2) - (icon_dim.w / 2);
+	icon_dim.y = dim->y + (dim->h / 2) - (icon_dim.h / 2);
+
+	if(icon_tex != NULL)
+	{
+		SDL_SetTextureColorMod(icon_tex,
+			el->elem.tile.fg.r, el->elem.tile.fg.g,
+			el->elem.tile.fg.b);
+		SDL_RenderCopy(ctx->ren, icon_tex, &icon_src, &icon_dim);
+	}
+	else if(icon_src.h != 0)
+	{
+		ui_draw_placeholder(ctx, &icon_dim);
+	}
+}
+
 /**
  * Draw tile element 'el' at point 'p'.
  *
@@ -796,8 +1380,9 @@ static void ui_draw_tile(ui_ctx_s *HEDLEY_RESTRICT ctx,
 	const SDL_Rect dim = {
 		.h = len, .w = len, .x = p->x, .y = p->y
 	};
-	SDL_Texture *text_tex, *icon_tex;
-	SDL_Rect text_dim, icon_dim;
+	SDL_Texture *text_tex;
+	SDL_Rect text_src = { 0 };
+	SDL_Rect text_dim;
 	const SDL_Point tile_padding = {
 		.x = ctx->padding.tile,
 		.y = ctx->padding.tile
@@ -810,86 +1395,58 @@ static void ui_draw_tile(ui_ctx_s *HEDLEY_RESTRICT ctx,
 		el->elem.tile.bg.b, el->elem.tile.bg.a);
 	SDL_RenderFillRect(ctx->ren, &dim);
 
-	/* Render icon on tile. */
-	label_hash = HASH_FN(&el->elem.tile.icon,
-		sizeof(el->elem.tile.icon), seed);
-	icon_tex = get_cached_texture(ctx->cache, UI_TEXTURE_PART_ICON,
-		label_hash, el);
-	if(icon_tex == NULL)
+	/* Render icon on tile. Icons are drawn from the icon atlas, which
+	 * holds the icons of all menus. */
 	{
-		icon_tex = font_render_icon(ctx->font, el->elem.tile.icon,
-				el->elem.tile.fg);
-		/* FIXME: Missing checks. */
-		store_cached_texture(ctx->cache, UI_TEXTURE_PART_ICON,
-			label_hash, el, icon_tex);
-	}
-	SDL_QueryTexture(icon_tex, NULL, NULL, &icon_dim.w, &icon_dim.h);
+		const SDL_Rect area = {
+			.x = dim.x + ctx->padding.tile / 2,
+			.y = dim.y + ctx->padding.tile / 2,
+			.w = dim.w - ctx->padding.tile,
+			.h = dim.h - ctx->padding.tile
+		};
 
-	/* If the icon texture is larger than the tile itself (due to the
-	 * cached icon being high resolution) then resize the icon until it
-	 * fits within the tile. */
-	while(icon_dim.w + ctx->padding.tile >= dim.w)
-	{
-		icon_dim.w /= 2;
-		icon_dim.h /= 2;
+		if(font_draw_icon(ctx->font, el->elem.tile.icon,
+			el->elem.tile.fg, &area) != 0)
+			ui_draw_tile_icon(ctx, el, &dim, seed);
 	}
-	icon_dim.x = p->x + (len / 2) - (icon_dim.w / 2);
-	icon_dim.y = p->y + (len / 2) - (icon_dim.h / 2);
 
-	SDL_SetTextureColorMod(icon_tex,
-		el->elem.tile.fg.r, el->elem.tile.fg.g,
-		el->elem.tile.fg.b);
-	SDL_RenderCopy(ctx->ren, icon_tex, NULL, &icon_dim);
-
-	/* Render tile label. */
-	label_hash = HASH_FN(el->label, SDL_strlen(el->label), seed);
-	text_tex = get_cached_texture(ctx->cache, UI_TEXTURE_PART_LABEL,
-		label_hash, el);
-	if(text_tex == NULL)
+	/* Render tile label. Labels of dynamic tiles are drawn from cached
+	 * glyphs, in the colour of the tile. */
+	text_dim.h = font_get_height(ctx->font, FONT_STYLE_HEADER);
+	ui_place_tile_label(el, p, len, tile_padding.x, &text_dim);
+	if((ctx->drawing_dynamic == SDL_FALSE &&
+			ctx->scaled_glyphs == SDL_FALSE) ||
+		font_draw_text(ctx->font, el->label, FONT_STYLE_HEADER,
+			el->elem.tile.fg, text_dim.x, text_dim.y, NULL) != 0)
 	{
-		text_tex = font_render_text(ctx->font, el->label,
-					FONT_STYLE_HEADER, FONT_QUALITY_HIGH,
-					text_colour_light);
+		label_hash = HASH_FN(el->label, SDL_strlen(el->label), seed);
+		text_tex = ui_get_part_texture(ctx, el, UI_TEXTURE_PART_LABEL,
+			FONT_STYLE_HEADER, text_colour_light, label_hash,
+			&text_src);
 		/* TODO: possible fatal error. */
-		if(text_tex == NULL)
+		if(text_tex == NULL && text_src.h == 0)
 			return;
+		text_dim.w = text_src.w;
+		text_dim.h = text_src.h;
+		ui_place_tile_label(el, p, len, tile_padding.x, &text_dim);
 
-		/* FIXME: Missing checks. */
-		store_cached_texture(ctx->cache, UI_TEXTURE_PART_LABEL,
-			label_hash, el, text_tex);
-	}
-	SDL_QueryTexture(text_tex, NULL, NULL, &text_dim.w, &text_dim.h);
-
-	switch(el->elem.tile.label_placement)
-	{
-	case LABEL_PLACEMENT_OUTSIDE_RIGHT_TOP:
-		text_dim.x = p->x + len + tile_padding.x;
-		text_dim.y = p->y;
-		break;
-
-	case LABEL_PLACEMENT_OUTSIDE_RIGHT_MIDDLE:
-		text_dim.x = p->x + len + tile_padding.x;
-		text_dim.y = p->y + (len / 2) - (text_dim.h / 2);
-		break;
-
-	case LABEL_PLACEMENT_OUTSIDE_RIGHT_BOTTOM:
-		text_dim.x = p->x + len + tile_padding.x;
-		text_dim.y = p->y + len - text_dim.h;
-		break;
-
-	default:
-		HEDLEY_UNREACHABLE();
-		break;
+		if(text_tex == NULL)
+		{
+			ui_draw_placeholder(ctx, &text_dim);
+		}
+		else
+		{
+			/* Colour of elements within tile. */
+			SDL_SetTextureColorMod(text_tex,
+				el->elem.tile.fg.r,
+				el->elem.tile.fg.g,
+				el->elem.tile.fg.b);
+
+			SDL_RenderCopy(ctx->ren, text_tex, &text_src,
+				&text_dim);
+		}
 	}
 
-	/* Colour of elements within tile. */
-	SDL_SetTextureColorMod(text_tex,
-		el->elem.tile.fg.r,
-		el->elem.tile.fg.g,
-		el->elem.tile.fg.b);
-
-	SDL_RenderCopy(ctx->ren, text_tex, NULL, &text_dim);
-
 	/* Add hitbox for mouse and touch input. */
 	{
 		struct hit_box i;
@@ -934,6 +1491,7 @@ static void ui_draw_dynamic(ui_ctx_s *HEDLEY_RESTRICT ctx,
 
 	user_ctx = el->elem.dynamic.user_ctx;
 	number_of_elements = el->elem.dynamic.number_of_elements(user_ctx);
+	ctx->drawing_dynamic = SDL_TRUE;
 
 	for(unsigned i = 0; i < number_of_elements; i++)
 	{
@@ -969,6 +1527,8 @@ static void ui_draw_dynamic(ui_ctx_s *HEDLEY_RESTRICT ctx,
 		/* Using the element number as the hash seed. */
 		ui_draw_element(ctx, &new, p, i);
 	}
+
+	ctx->drawing_dynamic = SDL_FALSE;
 }
 
 HEDLEY_NON_NULL(1,2,3)
@@ -999,6 +1559,166 @@ static void ui_draw_element(ui_ctx_s *HEDLEY_RESTRICT ctx,
 	}
 }
 
+/**
+ * Renders the label and icon of a single element into the cache, without
+ * drawing them. The label hashes must match those calculated when the element
+ * is drawn within a menu.
+ */
+HEDLEY_NON_NULL(1,2)
+static void ui_prefetch_element(ui_ctx_s *HEDLEY_RESTRICT ctx,
+	const struct ui_element *HEDLEY_RESTRICT el)
+{
+	SDL_Rect src;
+	Hash label_hash;
+
+	switch(el->type)
+	{
+	case UI_ELEM_TYPE_LABEL:
+		label_hash = HASH_FN(el->label, SDL_strlen(el->label), 0);
+		ui_get_part_texture(ctx, el, UI_TEXTURE_PART_LABEL,
+			el->elem.label.style, text_colour_light, label_hash,
+			&src);
+		break;
+
+	case UI_ELEM_TYPE_TILE:
+		/* Icons are drawn from the icon atlas. */
+		label_hash = HASH_FN(el->label, SDL_strlen(el->label), 0);
+		ui_get_part_texture(ctx, el, UI_TEXTURE_PART_LABEL,
+			FONT_STYLE_HEADER, text_colour_light, label_hash,
+			&src);
+		break;
+
+	default:
+		/* Members of dynamic elements are only known when they are
+		 * drawn. */
+		break;
+	}
+}
+
+/**
+ * Obtains a menu that may be opened next. The menu opened by the selected
+ * element is the first candidate, followed by the menus opened by the other
+ * elements of the current menu.
+ *
+ * \param n	Candidate number.
+ * \return	Candidate menu, or NULL if there are no further candidates.
+ */
+HEDLEY_NON_NULL(1)
+static const struct ui_element *ui_prefetch_candidate(const ui_ctx_s *ctx,
+	unsigned n)
+{
+	const struct ui_element *el;
+
+	if(ctx->selected->type == UI_ELEM_TYPE_TILE &&
+		ctx->selected->elem.tile.onclick.action ==
+			UI_EVENT_GOTO_ELEMENT)
+	{
+		if(n == 0)
+			return ctx->selected->elem.tile.onclick.action_data.goto_element.element;
+
+		n--;
+	}
+
+	for(el = ctx->current; el->type != UI_ELEM_TYPE_END; el++)
+	{
+		if(el == ctx->selected || el->type != UI_ELEM_TYPE_TILE ||
+			el->elem.tile.onclick.action != UI_EVENT_GOTO_ELEMENT)
+			continue;
+
+		if(n == 0)
+			return el->elem.tile.onclick.action_data.goto_element.element;
+
+		n--;
+	}
+
+	return NULL;
+}
+
+/**
+ * Renders the elements of menus that may be opened next into the cache, so
+ * that opening a menu does not require its elements to be rendered. Called
+ * on frames where the UI is not redrawn, and stops once the time budget is
+ * exceeded, continuing on the next idle frame.
+ */
+HEDLEY_NON_NULL(1)
+static void ui_prefetch(ui_ctx_s *ctx)
+{
+	const Uint64 freq = SDL_GetPerformanceFrequency();
+	const Uint64 deadline = SDL_GetPerformanceCounter() +
+		(freq * UI_PREFETCH_BUDGET_MS) / 1000;
+
+	/* Drafts are only rendered for labels that are drawn. */
+	ctx->draft_deadline = 0;
+
+	/* Labels and icons drawn from scaled glyphs are not cached. */
+	if(ctx->prefetch.complete == SDL_TRUE ||
+		ctx->scaled_glyphs == SDL_TRUE)
+		return;
+
+	for(;;)
+	{
+		const struct ui_element *menu;
+
+		if(ctx->prefetch.next == NULL)
+		{
+			menu = ui_prefetch_candidate(ctx,
+				ctx->prefetch.menus_done);
+			if(menu == NULL)
+			{
+				ctx->prefetch.complete = SDL_TRUE;
+				SDL_LogDebug(HAIYAJAN_LOG_CATEGORY_UI,
+					"Prefetched %u menus",
+					ctx->prefetch.menus_done);
+				return;
+			}
+
+			ctx->prefetch.next = menu;
+		}
+
+		while(ctx->prefetch.next->type != UI_ELEM_TYPE_END)
+		{
+			if(SDL_GetPerformanceCounter() >= deadline)
+				return;
+
+			ui_prefetch_element(ctx, ctx->prefetch.next);
+			ctx->prefetch.next++;
+		}
+
+		ctx->prefetch.next = NULL;
+		ctx->prefetch.menus_done++;
+	}
+}
+
+/**
+ * Periodically logs statistics of the texture cache, if verbose logging is
+ * enabled for the cache.
+ */
+static void ui_log_cache_stats(ui_ctx_s *ctx)
+{
+	struct ui_cache_stats st;
+	Uint32 now;
+
+	if(SDL_LogGetPriority(HAIYAJAN_LOG_CATEGORY_CACHE) >
+		SDL_LOG_PRIORITY_VERBOSE)
+		return;
+
+	now = SDL_GetTicks();
+	if(now - ctx->stats_logged_ms < UI_CACHE_STATS_INTERVAL_MS)
+		return;
+
+	ctx->stats_logged_ms = now;
+	get_cache_stats(ctx->cache, &st);
+	SDL_LogVerbose(HAIYAJAN_LOG_CATEGORY_CACHE,
+		"Cache: %" SDL_PRIu64 " hits, %" SDL_PRIu64 " misses "
+		"(%" SDL_PRIu64 " shared, %" SDL_PRIu64 " packed), "
+		"%" SDL_PRIu64 " stale, %" SDL_PRIu64 " evictions; "
+		"%u entries, %u bitmaps, %lu/%lu bytes, %u pages (%lu bytes)",
+		st.hits, st.misses, st.shared_hits, st.pack_hits,
+		st.stale, st.evictions, st.entries, st.bitmaps,
+		(unsigned long)st.bytes, (unsigned long)st.budget,
+		st.pages, (unsigned long)st.page_bytes);
+}
+
 HEDLEY_NON_NULL(1)
 SDL_Texture *ui_render_frame(ui_ctx_s *ctx)
 {
@@ -1011,11 +1731,25 @@ SDL_Texture *ui_render_frame(ui_ctx_s *ctx)
 	SDL_assert(ctx->tex != NULL);
 	SDL_assert(ctx->static_tex != NULL);
 
+	/* Textures removed from the cache during the previous frame are no
+	 * longer in use. */
+	destroy_retired_textures(ctx->cache);
+	ui_log_cache_stats(ctx);
+
+	/* Bitmaps rendered in the background since the previous frame
+	 * replace their placeholders. */
+	ui_collect_renders(ctx);
+
 	/* Check if any animations need to be rendered. */
 	ui_handle_offset(ctx);
 
 	if(ctx->redraw == SDL_FALSE)
+	{
+		/* Use idle frames to prepare menus that may be opened
+		 * next. */
+		ui_prefetch(ctx);
 		goto out;
+	}
 
 	/* Initialise a new hitbox array. */
 	if(ctx->hit_boxes != NULL)
@@ -1027,6 +1761,9 @@ SDL_Texture *ui_render_frame(ui_ctx_s *ctx)
 	if(SDL_SetRenderTarget(ctx->ren, ctx->static_tex) != 0)
 		return NULL;
 
+	ctx->draft_deadline = SDL_GetPerformanceCounter() +
+		(SDL_GetPerformanceFrequency() * UI_DRAFT_BUDGET_MS) / 1000;
+
 	/* Calculate where the first element should appear vertically. */
 	SDL_GetRendererOutputSize(ctx->ren, &w, &h);
 	vert.x = w / 8;
@@ -1111,6 +1848,57 @@ static const struct ui_element *get_prev_selectable_ui_element(
 	return e;
 }
 
+/**
+ * Rasterises the icons of every tile within the menus reachable from the root
+ * menu, so that drawing a tile does not rasterise its icon. Icons of dynamic
+ * elements are only known when they are drawn, so they are rasterised then.
+ */
+HEDLEY_NON_NULL(1)
+static void ui_prepare_icons(ui_ctx_s *ctx)
+{
+	const struct ui_element **menus = NULL;
+	Uint16 *icons = NULL;
+
+	stb_arr_push(menus, ctx->root);
+	for(int m = 0; m < stb_arr_len(menus); m++)
+	{
+		const struct ui_element *el;
+
+		for(el = menus[m]; el->type != UI_ELEM_TYPE_END; el++)
+		{
+			const struct ui_event *click = &el->elem.tile.onclick;
+			const struct ui_element *next;
+			SDL_bool seen = SDL_FALSE;
+
+			if(el->type != UI_ELEM_TYPE_TILE)
+				continue;
+
+			stb_arr_push(icons, el->elem.tile.icon);
+
+			if(click->action != UI_EVENT_GOTO_ELEMENT)
+				continue;
+
+			/* Menus may link back to a parent menu. */
+			next = click->action_data.goto_element.element;
+			for(int i = 0; i < stb_arr_len(menus); i++)
+			{
+				if(menus[i] == next)
+				{
+					seen = SDL_TRUE;
+					break;
+				}
+			}
+
+			if(next != NULL && seen == SDL_FALSE)
+				stb_arr_push(menus, next);
+		}
+	}
+
+	font_set_icons(ctx->font, icons, (size_t)stb_arr_len(icons));
+
+	stb_arr_free(icons);
+	stb_arr_free(menus);
+}
 
 HEDLEY_NON_NULL(1,6)
 HEDLEY_MALLOC
@@ -1151,16 +1939,49 @@ static ui_ctx_s *ui_init_renderer(SDL_Renderer *HEDLEY_RESTRICT rend,
 		}
 	}
 
-	ctx->tex = SDL_CreateTexture(ctx->ren, format,
-		SDL_TEXTUREACCESS_TARGET, w, h);
+	ctx->cache = init_cached_texture(ctx->ren);
+	if(ctx->cache == NULL)
+		goto err;
+
+	ctx->tex = acquire_target_texture(ctx->cache, ctx->ren, format, w, h);
 	if(ctx->tex == NULL)
 		goto err;
 
-	ctx->static_tex = SDL_CreateTexture(ctx->ren, format,
-		SDL_TEXTUREACCESS_TARGET, w, h);
+	ctx->static_tex = acquire_target_texture(ctx->cache, ctx->ren, format,
+		w, h);
 	if(ctx->static_tex == NULL)
 		goto err;
 
+	/* Load bitmaps rendered in previous sessions, so that the first frame
+	 * does not have to render any text. */
+	{
+		char *pref;
+
+		pref = SDL_GetPrefPath(HAIYAJAN_PREF_ORG, HAIYAJAN_PREF_APP);
+		if(pref != NULL)
+		{
+			size_t len = SDL_strlen(pref) +
+				sizeof(UI_TEXTURE_PACK_FILENAME);
+			char *path = SDL_malloc(len);
+
+			if(path != NULL)
+			{
+				SDL_snprintf(path, len, "%s%s", pref,
+					UI_TEXTURE_PACK_FILENAME);
+				load_texture_pack(ctx->cache, path);
+				SDL_free(path);
+			}
+
+			SDL_free(pref);
+		}
+		else
+		{
+			SDL_LogWarn(HAIYAJAN_LOG_CATEGORY_UI,
+				"Unable to obtain preferences directory: %s",
+				SDL_GetError());
+		}
+	}
+
 	ctx->root = ui_elements;
 	ctx->current = ui_elements;
 	ctx->selected = get_first_selectable_ui_element(ui_elements, ui_elements);
@@ -1171,17 +1992,18 @@ static ui_ctx_s *ui_init_renderer(SDL_Renderer *HEDLEY_RESTRICT rend,
 	ctx->vdpi = (unsigned)SDL_ceilf(vdpi);
 	ctx->dpi_multiply = dpi / dpi_reference;
 
-	ctx->cache = init_cached_texture();
-
 	ctx->font = font_init(rend);
 	if(ctx->font == NULL)
-	{
-		SDL_DestroyTexture(ctx->tex);
-		SDL_DestroyTexture(ctx->static_tex);
 		goto err;
-	}
+
+	ctx->scaled_glyphs = SDL_GetHintBoolean(UI_HINT_SCALED_GLYPHS,
+		SDL_FALSE);
+	ctx->progressive_text = SDL_GetHintBoolean(UI_HINT_PROGRESSIVE_TEXT,
+		SDL_TRUE);
+	font_set_scaled_glyphs(ctx->font, ctx->scaled_glyphs);
 
 	ui_resize_all(ctx, w, h);
+	ui_prepare_icons(ctx);
 
 	/* Draw the first frame. */
 	ctx->redraw = SDL_TRUE;
@@ -1190,6 +2012,13 @@ out:
 	return ctx;
 
 err:
+	if(ctx != NULL && ctx->cache != NULL)
+	{
+		recycle_target_texture(ctx->cache, ctx->tex);
+		recycle_target_texture(ctx->cache, ctx->static_tex);
+		deinit_cached_texture(ctx->cache);
+	}
+
 	SDL_free(ctx);
 	ctx = NULL;
 	goto out;
@@ -1249,6 +2078,13 @@ err:
 	goto out;
 }
 
+HEDLEY_NON_NULL(1,2)
+void ui_get_cache_stats(const ui_ctx_s *HEDLEY_RESTRICT ctx,
+	struct ui_cache_stats *HEDLEY_RESTRICT stats)
+{
+	get_cache_stats(ctx->cache, stats);
+}
+
 HEDLEY_NON_NULL(1)
 void ui_exit(ui_ctx_s *ctx)
 {
@@ -1257,11 +2093,15 @@ void ui_exit(ui_ctx_s *ctx)
 #endif
 
 	font_exit(ctx->font);
+	stb_arr_free(ctx->pending);
+	stb_arr_free(ctx->failed);
+
+	save_texture_pack(ctx->cache);
 
-	clear_cached_textures(ctx->cache);
+	/* Destroys all cached textures, including the render targets. */
+	recycle_target_texture(ctx->cache, ctx->tex);
+	recycle_target_texture(ctx->cache, ctx->static_tex);
 	deinit_cached_texture(ctx->cache);
-	SDL_DestroyTexture(ctx->tex);
-	SDL_DestroyTexture(ctx->static_tex);
 	stb_arr_setlen(ctx->hit_boxes, 0);
 	SDL_free(ctx);
 }
@@ -0,0 +1,287 @@
+/**
+ * Tests of the texture cache, using the software renderer.
+ * Copyright (C) 2022 Mahyar Koshkouei
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ */
+
+/* Static functions are tested directly. */
+#include "../src/cache.c"
+#include "minctest.h"
+
+#define TEST_ELEMENTS 500
+
+static SDL_Renderer *rend = NULL;
+static SDL_Surface *target = NULL;
+
+/**
+ * Checks that every entry is found at its slot of the index, and that no
+ * other slot is used.
+ */
+static SDL_bool index_is_valid(const cache_ctx_s *ctx)
+{
+	unsigned count = stb_arr_len(ctx->cached_ui);
+	unsigned used = 0;
+
+	if(ctx->index == NULL)
+		return count == 0 ? SDL_TRUE : SDL_FALSE;
+
+	for(unsigned i = 0; i < count; i++)
+	{
+		const struct textures *t = &ctx->cached_ui[i];
+		Uint32 slot = cache_index_find(ctx, t->data_origin, t->part,
+			t->generation);
+
+		if(ctx->index[slot] != i + 1)
+			return SDL_FALSE;
+	}
+
+	for(Uint32 slot = 0; slot <= ctx->index_mask; slot++)
+	{
+		if(ctx->index[slot] != 0)
+			used++;
+	}
+
+	return used == count ? SDL_TRUE : SDL_FALSE;
+}
+
+static SDL_bool rects_overlap(const SDL_Rect *a, const SDL_Rect *b)
+{
+	return a->x < b->x + b->w && b->x < a->x + a->w &&
+		a->y < b->y + b->h && b->y < a->y + a->h ?
+		SDL_TRUE : SDL_FALSE;
+}
+
+static void test_shelf_packer(void)
+{
+	struct atlas_page page = { 0 };
+	SDL_Rect a, b, c, d, r[256];
+	unsigned n = 0;
+	SDL_bool valid = SDL_TRUE;
+
+	page.w = 64;
+	page.h = 64;
+
+	/* Bitmaps are placed on the shortest shelf that fits them. */
+	lok(atlas_page_alloc(&page, 8, 10, &a) == SDL_TRUE);
+	lok(atlas_page_alloc(&page, 8, 20, &b) == SDL_TRUE);
+	lok(atlas_page_alloc(&page, 8, 9, &c) == SDL_TRUE);
+	lequal(a.y, 0);
+	lequal(b.y, 10);
+	lequal(c.y, a.y);
+	lequal(c.x, 8);
+
+	/* A shelf more than twice the height of a bitmap is not used. */
+	lok(atlas_page_alloc(&page, 8, 4, &d) == SDL_TRUE);
+	lequal(d.y, 30);
+
+	/* Bitmaps wider than the page never fit. */
+	lok(atlas_page_alloc(&page, 65, 1, &r[0]) == SDL_FALSE);
+	lequal(stb_arr_len(page.shelves), 3);
+
+	/* Fill the page with bitmaps of varied sizes. */
+	r[n++] = a;
+	r[n++] = b;
+	r[n++] = c;
+	r[n++] = d;
+	for(unsigned i = 0; n < SDL_arraysize(r); i++)
+	{
+		int w = 3 + (int)(i * 7 % 13);
+		int h = 2 + (int)(i * 5 % 11);
+
+		if(atlas_page_alloc(&page, w, h, &r[n]) == SDL_FALSE)
+		{
+			/* Keep going until even small bitmaps do not fit. */
+			if(atlas_page_alloc(&page, 1, 1, &r[n]) == SDL_FALSE)
+				break;
+		}
+
+		n++;
+	}
+
+	lok(n > 4);
+	for(unsigned i = 0; i < n; i++)
+	{
+		if(r[i].x < 0 || r[i].y < 0 || r[i].x + r[i].w > page.w ||
+			r[i].y + r[i].h > page.h)
+			valid = SDL_FALSE;
+
+		for(unsigned j = 0; j < i; j++)
+		{
+			if(rects_overlap(&r[i], &r[j]) == SDL_TRUE)
+				valid = SDL_FALSE;
+		}
+	}
+	lok(valid == SDL_TRUE);
+
+	stb_arr_free(page.shelves);
+}
+
+static SDL_Surface *create_surface(int w, int h)
+{
+	SDL_Surface *s = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32,
+		SDL_PIXELFORMAT_ARGB8888);
+
+	SDL_assert_always(s != NULL);
+	SDL_FillRect(s, NULL, 0xFFFFFFFF);
+	return s;
+}
+
+static Uint64 element_key(unsigned i, ui_texture_part_e part)
+{
+	return ((Uint64)i << 1 | part) + 1;
+}
+
+static void test_index(void)
+{
+	struct ui_element *els;
+	cache_ctx_s *ctx;
+	SDL_Surface *s = create_surface(4, 4);
+	struct ui_cache_stats stats;
+	SDL_Rect src;
+	unsigned stored = 0, hits = 0, misses = 0;
+
+	els = SDL_calloc(TEST_ELEMENTS, sizeof(*els));
+	ctx = init_cached_texture(rend);
+	SDL_assert_always(els != NULL && ctx != NULL);
+
+	for(unsigned i = 0; i < TEST_ELEMENTS; i++)
+	{
+		els[i].type = UI_ELEM_TYPE_LABEL;
+		els[i].label = "Label";
+
+		for(int p = 0; p < 2; p++)
+		{
+			if(store_cached_surface(ctx, p, i, &els[i],
+				element_key(i, p), s, &src) != NULL)
+				stored++;
+		}
+	}
+	lequal(stored, TEST_ELEMENTS * 2);
+	lok(index_is_valid(ctx) == SDL_TRUE);
+
+	/* Every third element is changed, which deletes its entries. */
+	for(unsigned i = 0; i < TEST_ELEMENTS; i += 3)
+	{
+		for(int p = 0; p < 2; p++)
+		{
+			if(get_cached_texture(ctx, p, i + 1, &els[i],
+				element_key(i, p), &src) == NULL)
+				misses++;
+		}
+	}
+	lequal(misses, (TEST_ELEMENTS + 2) / 3 * 2);
+	lok(index_is_valid(ctx) == SDL_TRUE);
+
+	/* Remaining entries are still found after the deleted entries were
+	 * shifted out of their probe sequences. */
+	misses = 0;
+	for(unsigned i = 0; i < TEST_ELEMENTS; i++)
+	{
+		for(int p = 0; p < 2; p++)
+		{
+			SDL_Texture *tex = get_cached_texture(ctx, p, i,
+				&els[i], element_key(i, p), &src);
+
+			if(tex == NULL)
+				misses++;
+			else if(i % 3 != 0 && src.w == 4 && src.h == 4)
+				hits++;
+		}
+	}
+	lequal(hits, TEST_ELEMENTS * 2 - (TEST_ELEMENTS + 2) / 3 * 2);
+	lequal(misses, (TEST_ELEMENTS + 2) / 3 * 2);
+
+	/* Other content for an unchanged element is a miss, but does not
+	 * delete the entry. */
+	lok(get_cached_texture(ctx, UI_TEXTURE_PART_LABEL, 1, &els[1],
+		element_key(2, 0), &src) == NULL);
+	lok(get_cached_texture(ctx, UI_TEXTURE_PART_LABEL, 1, &els[1],
+		element_key(1, 0), &src) != NULL);
+
+	get_cache_stats(ctx, &stats);
+	lequal(stats.entries, hits);
+	lok(index_is_valid(ctx) == SDL_TRUE);
+
+	deinit_cached_texture(ctx);
+	SDL_FreeSurface(s);
+	SDL_free(els);
+}
+
+static void test_budget(void)
+{
+	struct ui_element *els;
+	cache_ctx_s *ctx;
+	SDL_Surface *s = create_surface(64, 64);
+	struct ui_cache_stats stats;
+	size_t page_sz;
+	SDL_Rect src;
+
+	els = SDL_calloc(TEST_ELEMENTS, sizeof(*els));
+	ctx = init_cached_texture(rend);
+	SDL_assert_always(els != NULL && ctx != NULL);
+	page_sz = (size_t)ctx->page_w * (size_t)ctx->page_h *
+		SDL_BYTESPERPIXEL(ctx->page_format);
+
+	/* Spread the bitmaps over several pages. */
+	for(unsigned i = 0; i < TEST_ELEMENTS; i++)
+	{
+		els[i].type = UI_ELEM_TYPE_LABEL;
+		els[i].label = "Label";
+		store_cached_surface(ctx, UI_TEXTURE_PART_LABEL, i, &els[i],
+			element_key(i, 0), s, &src);
+	}
+
+	get_cache_stats(ctx, &stats);
+	lok(stats.pages > 1);
+
+	/* Lowering the budget releases whole pages. */
+	set_cached_texture_budget(ctx, page_sz);
+	get_cache_stats(ctx, &stats);
+	lok(stats.page_bytes <= page_sz);
+	lok(stats.bytes <= page_sz);
+	lok(stats.entries > 0);
+	lok(index_is_valid(ctx) == SDL_TRUE);
+
+	/* Bitmaps larger than a page are stored within the budget. */
+	{
+		SDL_Surface *big = create_surface(ctx->page_w + 1, 8);
+
+		lok(store_cached_surface(ctx, UI_TEXTURE_PART_ICON, 0, &els[0],
+			element_key(0, 1), big, &src) != NULL);
+		get_cache_stats(ctx, &stats);
+		lok(stats.page_bytes <= page_sz);
+		SDL_FreeSurface(big);
+	}
+
+	destroy_retired_textures(ctx);
+	deinit_cached_texture(ctx);
+	SDL_FreeSurface(s);
+	SDL_free(els);
+}
+
+int main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_CRITICAL);
+
+	target = SDL_CreateRGBSurfaceWithFormat(0, 64, 64, 32,
+		SDL_PIXELFORMAT_ARGB8888);
+	SDL_assert_always(target != NULL);
+	rend = SDL_CreateSoftwareRenderer(target);
+	SDL_assert_always(rend != NULL);
+
+	lrun("Shelf packer", test_shelf_packer);
+	lrun("Index", test_index);
+	lrun("Budget", test_budget);
+	lresults();
+
+	SDL_DestroyRenderer(rend);
+	SDL_FreeSurface(target);
+
+	return lfails != 0;
+}
@@ -0,0 +1,567 @@
+/**
+ * Tests of the reading of font files and of the saved index of installed
+ * fonts. Fonts are built in memory, and hold only the tables that are read.
+ * Copyright (C) 2022 Mahyar Koshkouei
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3, as published by
+ * the Free Software Foundation.
+ */
+
+/* Static functions are tested directly. The implementation of stb_arr is
+ * otherwise provided by cache.c. */
+#define STB_LIB_IMPLEMENTATION
+#include "../src/fontindex.c"
+#include "minctest.h"
+
+#define TEST_INDEX_PATH "test_fontindex.hyfi"
+
+/* Size of a bitmap of every code point. */
+#define TEST_MAP_LEN (0x110000 / 8)
+
+struct font_buf {
+	Uint8 data[1024];
+	size_t len;
+};
+
+static void put16(struct font_buf *b, Uint16 v)
+{
+	SDL_assert_always(b->len + 2 <= sizeof(b->data));
+	b->data[b->len++] = (Uint8)(v >> 8);
+	b->data[b->len++] = (Uint8)v;
+}
+
+static void put32(struct font_buf *b, Uint32 v)
+{
+	put16(b, (Uint16)(v >> 16));
+	put16(b, (Uint16)v);
+}
+
+static void put_bytes(struct font_buf *b, const Uint8 *p, size_t len)
+{
+	SDL_assert_always(b->len + len <= sizeof(b->data));
+	SDL_memcpy(b->data + b->len, p, len);
+	b->len += len;
+}
+
+/**
+ * Builds a character map holding a format 4 subtable for the Basic
+ * Multilingual Plane and, if full is set, a format 12 subtable for all of
+ * Unicode. The format 12 subtable is listed last, so that it is only read if
+ * it is preferred.
+ */
+static void build_cmap(struct font_buf *b, SDL_bool full)
+{
+	static const Uint16 ends[] = { 0x007E, 0x04FF, 0xFFFF };
+	static const Uint16 starts[] = { 0x0020, 0x0400, 0xFFFF };
+	const unsigned segs = SDL_arraysize(ends);
+	const Uint32 fmt4_len = 16 + segs * 8;
+
+	put16(b, 0);
+	put16(b, full == SDL_TRUE ? 2 : 1);
+	put16(b, 3);
+	put16(b, 1);
+	put32(b, full == SDL_TRUE ? 4 + 2 * 8 : 4 + 8);
+	if(full == SDL_TRUE)
+	{
+		put16(b, 3);
+		put16(b, 10);
+		put32(b, 4 + 2 * 8 + fmt4_len);
+	}
+
+	put16(b, 4);
+	put16(b, (Uint16)fmt4_len);
+	put16(b, 0);
+	put16(b, (Uint16)(segs * 2));
+	put16(b, 4);
+	put16(b, 1);
+	put16(b, 2);
+	for(unsigned i = 0; i < segs; i++)
+		put16(b, ends[i]);
+	put16(b, 0);
+	for(unsigned i = 0; i < segs; i++)
+		put16(b, starts[i]);
+	for(unsigned i = 0; i < segs; i++)
+		put16(b, 1);
+	for(unsigned i = 0; i < segs; i++)
+		put16(b, 0);
+
+	if(full == SDL_FALSE)
+		return;
+
+	put16(b, 12);
+	put16(b, 0);
+	put32(b, 16 + 3 * 12);
+	put32(b, 0);
+	put32(b, 3);
+	put32(b, 0x0041);
+	put32(b, 0x005A);
+	put32(b, 1);
+	put32(b, 0x1F600);
+	put32(b, 0x1F64F);
+	put32(b, 27);
+	/* Groups that run backwards are ignored. */
+	put32(b, 0x3000);
+	put32(b, 0x2000);
+	put32(b, 107);
+}
+
+/**
+ * Builds a naming table. The family is given in Mac Roman, and in UTF-16 for
+ * US English on Windows. The style is only given in Mac Roman.
+ */
+static void build_name(struct font_buf *b)
+{
+	static const Uint8 family_w[] = {
+		0x00, 'N', 0x00, 'o', 0x00, 't', 0x00, 'o', 0x00, ' ',
+		0x00, 0xE9, 0x4E, 0x00
+	};
+	static const Uint8 family_m[] = { 'M', 'a', 'c' };
+	static const Uint8 style_m[] = { 'B', 'o', 'l', 'd' };
+	const Uint16 count = 3;
+
+	put16(b, 0);
+	put16(b, count);
+	put16(b, 6 + count * 12);
+
+	put16(b, 1);
+	put16(b, 0);
+	put16(b, 0);
+	put16(b, SFNT_NAME_FAMILY);
+	put16(b, sizeof(family_m));
+	put16(b, 0);
+
+	put16(b, 3);
+	put16(b, 1);
+	put16(b, 0x0409);
+	put16(b, SFNT_NAME_FAMILY);
+	put16(b, sizeof(family_w));
+	put16(b, sizeof(family_m));
+
+	put16(b, 1);
+	put16(b, 0);
+	put16(b, 0);
+	put16(b, SFNT_NAME_STYLE);
+	put16(b, sizeof(style_m));
+	put16(b, sizeof(family_m) + sizeof(family_w));
+
+	put_bytes(b, family_m, sizeof(family_m));
+	put_bytes(b, family_w, sizeof(family_w));
+	put_bytes(b, style_m, sizeof(style_m));
+}
+
+/**
+ * Builds a font holding a character map and a naming table. If ttc is set,
+ * the font is the first of a font collection.
+ */
+static void build_font(struct font_buf *b, SDL_bool full, SDL_bool ttc)
+{
+	struct font_buf cmap = { 0 }, name = { 0 };
+	Uint32 off;
+
+	build_cmap(&cmap, full);
+	build_name(&name);
+
+	b->len = 0;
+	if(ttc == SDL_TRUE)
+	{
+		put32(b, SFNT_TAG('t', 't', 'c', 'f'));
+		put32(b, 0x00010000);
+		put32(b, 1);
+		put32(b, 16);
+	}
+
+	off = (Uint32)b->len + 12 + 2 * 16;
+	put32(b, 0x00010000);
+	put16(b, 2);
+	put16(b, 32);
+	put16(b, 1);
+	put16(b, 0);
+
+	put32(b, SFNT_TAG('c', 'm', 'a', 'p'));
+	put32(b, 0);
+	put32(b, off);
+	put32(b, (Uint32)cmap.len);
+
+	put32(b, SFNT_TAG('n', 'a', 'm', 'e'));
+	put32(b, 0);
+	put32(b, off + (Uint32)cmap.len);
+	put32(b, (Uint32)name.len);
+
+	put_bytes(b, cmap.data, cmap.len);
+	put_bytes(b, name.data, name.len);
+}
+
+static SDL_bool map_has(const Uint8 *map, Uint32 cp)
+{
+	return (map[cp / 8] & (1 << (cp % 8))) != 0 ? SDL_TRUE : SDL_FALSE;
+}
+
+/**
+ * Reads the coverage of a font held in memory.
+ */
+static int read_coverage(const Uint8 *data, size_t len, Uint8 *map)
+{
+	SDL_RWops *rw = SDL_RWFromConstMem(data, (int)len);
+	int ret;
+
+	SDL_assert_always(rw != NULL);
+	SDL_memset(map, 0, TEST_MAP_LEN);
+	ret = font_index_read_coverage(rw, map, TEST_MAP_LEN);
+	SDL_RWclose(rw);
+	return ret;
+}
+
+/**
+ * Checks that no code point that the complete font does not provide is
+ * marked as provided.
+ */
+static SDL_bool map_within(const Uint8 *map, const Uint8 *full)
+{
+	for(size_t i = 0; i < TEST_MAP_LEN; i++)
+	{
+		if((map[i] & ~full[i]) != 0)
+			return SDL_FALSE;
+	}
+
+	return SDL_TRUE;
+}
+
+static void test_cmap_format4(void)
+{
+	struct font_buf b;
+	Uint8 *map = SDL_malloc(TEST_MAP_LEN);
+
+	SDL_assert_always(map != NULL);
+	build_font(&b, SDL_FALSE, SDL_FALSE);
+	lequal(read_coverage(b.data, b.len, map), 0);
+
+	lok(map_has(map, 0x20) == SDL_TRUE);
+	lok(map_has(map, 0x7E) == SDL_TRUE);
+	lok(map_has(map, 0x1F) == SDL_FALSE);
+	lok(map_has(map, 0x7F) == SDL_FALSE);
+	lok(map_has(map, 0x400) == SDL_TRUE);
+	lok(map_has(map, 0x4FF) == SDL_TRUE);
+	lok(map_has(map, 0x500) == SDL_FALSE);
+
+	/* The final segment maps no code points. */
+	lok(map_has(map, 0xFFFF) == SDL_FALSE);
+
+	SDL_free(map);
+}
+
+static void test_cmap_format12(void)
+{
+	struct font_buf b;
+	Uint8 *map = SDL_malloc(TEST_MAP_LEN);
+
+	SDL_assert_always(map != NULL);
+	build_font(&b, SDL_TRUE, SDL_FALSE);
+	lequal(read_coverage(b.data, b.len, map), 0);
+
+	/* The map of all of Unicode is read instead of the BMP map. */
+	lok(map_has(map, 0x41) == SDL_TRUE);
+	lok(map_has(map, 0x5A) == SDL_TRUE);
+	lok(map_has(map, 0x20) == SDL_FALSE);
+	lok(map_has(map, 0x400) == SDL_FALSE);
+	lok(map_has(map, 0x1F600) == SDL_TRUE);
+	lok(map_has(map, 0x1F64F) == SDL_TRUE);
+	lok(map_has(map, 0x1F650) == SDL_FALSE);
+	lok(map_has(map, 0x2000) == SDL_FALSE);
+	lok(map_has(map, 0x3000) == SDL_FALSE);
+
+	/* Code points beyond the end of the bitmap are not marked. */
+	SDL_memset(map, 0, TEST_MAP_LEN);
+	{
+		SDL_RWops *rw = SDL_RWFromConstMem(b.data, (int)b.len);
+
+		lequal(font_index_read_coverage(rw, map, 0x1F608 / 8), 0);
+		SDL_RWclose(rw);
+	}
+	lok(map_has(map, 0x1F600) == SDL_TRUE);
+
+	SDL_free(map);
+}
+
+static void test_ttc(void)
+{
+	struct font_buf b;
+	Uint8 *map = SDL_malloc(TEST_MAP_LEN);
+
+	SDL_assert_always(map != NULL);
+	build_font(&b, SDL_TRUE, SDL_TRUE);
+	lequal(read_coverage(b.data, b.len, map), 0);
+	lok(map_has(map, 0x1F600) == SDL_TRUE);
+
+	/* The offset of the first font is beyond the end of the file. */
+	b.data[14] = 0x10;
+	lequal(read_coverage(b.data, b.len, map), -1);
+
+	/* A collection that holds no fonts. */
+	build_font(&b, SDL_TRUE, SDL_TRUE);
+	b.data[11] = 0;
+	lequal(read_coverage(b.data, b.len, map), -1);
+
+	SDL_free(map);
+}
+
+static void test_corrupt_sfnt(void)
+{
+	struct font_buf b;
+	Uint8 *map = SDL_malloc(TEST_MAP_LEN);
+
+	SDL_assert_always(map != NULL);
+
+	/* Unknown version of the font file. */
+	build_font(&b, SDL_TRUE, SDL_FALSE);
+	b.data[0] = 'X';
+	lequal(read_coverage(b.data, b.len, map), -1);
+
+	/* Too many tables. */
+	build_font(&b, SDL_TRUE, SDL_FALSE);
+	b.data[4] = 0xFF;
+	lequal(read_coverage(b.data, b.len, map), -1);
+
+	/* No character map. */
+	build_font(&b, SDL_TRUE, SDL_FALSE);
+	b.data[12] = 'X';
+	lequal(read_coverage(b.data, b.len, map), -1);
+
+	/* Character map beyond the end of the file. */
+	build_font(&b, SDL_TRUE, SDL_FALSE);
+	b.data[20] = 0x7F;
+	lequal(read_coverage(b.data, b.len, map), -1);
+
+	/* Too many subtables within the character map. */
+	build_font(&b, SDL_TRUE, SDL_FALSE);
+	b.data[44 + 2] = 0xFF;
+	lequal(read_coverage(b.data, b.len, map), -1);
+
+	/* Unsupported format of the preferred subtable. */
+	build_font(&b, SDL_TRUE, SDL_FALSE);
+	b.data[44 + 20 + 40 + 1] = 6;
+	lequal(read_coverage(b.data, b.len, map), -1);
+
+	/* Too many groups within the format 12 subtable. */
+	build_font(&b, SDL_TRUE, SDL_FALSE);
+	b.data[44 + 20 + 40 + 12] = 0xFF;
+	lequal(read_coverage(b.data, b.len, map), -1);
+
+	SDL_free(map);
+}
+
+static void test_truncated_sfnt(void)
+{
+	Uint8 *map = SDL_malloc(TEST_MAP_LEN);
+	Uint8 *full = SDL_malloc(TEST_MAP_LEN);
+
+	SDL_assert_always(map != NULL && full != NULL);
+
+	for(int ttc = 0; ttc < 2; ttc++)
+	{
+		struct font_buf b;
+		SDL_bool within = SDL_TRUE;
+		int failed = 0;
+
+		build_font(&b, SDL_TRUE, ttc == 1 ? SDL_TRUE : SDL_FALSE);
+		lequal(read_coverage(b.data, b.len, full), 0);
+
+		/* Fonts cut short anywhere must not mark code points that the
+		 * complete font does not provide. */
+		for(size_t len = 0; len < b.len; len++)
+		{
+			if(read_coverage(b.data, len, map) != 0)
+				failed++;
+
+			if(map_within(map, full) == SDL_FALSE)
+				within = SDL_FALSE;
+		}
+
+		lok(within == SDL_TRUE);
+		lok(failed > 0);
+	}
+
+	SDL_free(map);
+	SDL_free(full);
+}
+
+static char *read_name(const Uint8 *data, size_t len, Uint16 id)
+{
+	SDL_RWops *rw = SDL_RWFromConstMem(data, (int)len);
+	struct sfnt_tables t;
+	char *name = NULL;
+
+	SDL_assert_always(rw != NULL);
+	if(sfnt_find_tables(rw, &t) == 0 && t.name_off != 0)
+		name = sfnt_read_name(rw, t.name_off, id);
+
+	SDL_RWclose(rw);
+	return name;
+}
+
+static void test_name(void)
+{
+	static const char family[] = "Noto \xC3\xA9\xE4\xB8\x80";
+	struct font_buf b;
+	char *name;
+	SDL_bool valid = SDL_TRUE;
+
+	build_font(&b, SDL_FALSE, SDL_TRUE);
+
+	/* US English names on Windows are preferred, and are converted from
+	 * UTF-16 to UTF-8. */
+	name = read_name(b.data, b.len, SFNT_NAME_FAMILY);
+	lok(name != NULL);
+	if(name != NULL)
+		lsequal(name, family);
+	SDL_free(name);
+
+	name = read_name(b.data, b.len, SFNT_NAME_STYLE);
+	lok(name != NULL);
+	if(name != NULL)
+		lsequal(name, "Bold");
+	SDL_free(name);
+
+	name = read_name(b.data, b.len, 3);
+	lok(name == NULL);
+
+	/* A name cut short is not read, and no other name is returned. */
+	for(size_t len = 0; len < b.len; len++)
+	{
+		name = read_name(b.data, len, SFNT_NAME_FAMILY);
+		if(name != NULL && SDL_strcmp(name, family) != 0)
+			valid = SDL_FALSE;
+
+		SDL_free(name);
+	}
+	lok(valid == SDL_TRUE);
+}
+
+#ifdef FONT_INDEX_SCAN
+static void add_entry(font_index_s *idx, const char *path,
+	const char *family, Uint32 block_word)
+{
+	struct font_index_entry e = { 0 };
+
+	e.path = SDL_strdup(path);
+	e.family = family != NULL ? SDL_strdup(family) : NULL;
+	e.style = family != NULL ? SDL_strdup("Regular") : NULL;
+	e.mtime = 1234567890123LL;
+	e.size = 4096;
+	e.blocks[0] = block_word;
+	e.blocks[FONT_INDEX_BLOCK_WORDS - 1] = 0x80000001u;
+	stb_arr_push(idx->entries, e);
+}
+
+static void free_index(font_index_s *idx)
+{
+	font_index_free_entries(idx->entries);
+	font_index_free_dirs(idx->dirs);
+	idx->entries = NULL;
+	idx->dirs = NULL;
+}
+
+static void test_index_round_trip(void)
+{
+	font_index_s saved = { 0 }, loaded = { 0 };
+	struct font_index_dir d;
+	Uint8 *file;
+	size_t file_sz;
+	SDL_bool failed = SDL_TRUE;
+
+	saved.path = TEST_INDEX_PATH;
+	loaded.path = TEST_INDEX_PATH;
+
+	d.path = SDL_strdup("/usr/share/fonts");
+	d.mtime = -5;
+	stb_arr_push(saved.dirs, d);
+
+	/* Entries are saved in any order, and sorted by path when loaded. */
+	add_entry(&saved, "/usr/share/fonts/b.ttf", "B Sans", 0x1u);
+	add_entry(&saved, "/usr/share/fonts/a.otf", NULL, 0xFFFFFFFFu);
+
+	font_index_save(&saved);
+	lequal(font_index_load(&loaded), 0);
+	lequal(stb_arr_len(loaded.dirs), 1);
+	lequal(stb_arr_len(loaded.entries), 2);
+	if(stb_arr_len(loaded.dirs) == 1 && stb_arr_len(loaded.entries) == 2)
+	{
+		const struct font_index_entry *a = &loaded.entries[0];
+		const struct font_index_entry *b = &loaded.entries[1];
+
+		lsequal(loaded.dirs[0].path, "/usr/share/fonts");
+		lok(loaded.dirs[0].mtime == -5);
+
+		lsequal(a->path, "/usr/share/fonts/a.otf");
+		lok(a->family == NULL);
+		lok(a->style == NULL);
+		lok(a->blocks[0] == 0xFFFFFFFFu);
+
+		lsequal(b->path, "/usr/share/fonts/b.ttf");
+		lok(b->family != NULL && SDL_strcmp(b->family, "B Sans") == 0);
+		lok(b->style != NULL && SDL_strcmp(b->style, "Regular") == 0);
+		lok(b->mtime == 1234567890123LL);
+		lok(b->size == 4096);
+		lok(b->blocks[0] == 0x1u);
+		lok(b->blocks[FONT_INDEX_BLOCK_WORDS - 1] == 0x80000001u);
+	}
+	free_index(&loaded);
+
+	/* An index cut short anywhere is rejected as a whole. */
+	file = SDL_LoadFile(TEST_INDEX_PATH, &file_sz);
+	SDL_assert_always(file != NULL);
+	for(size_t len = 0; len < file_sz; len++)
+	{
+		SDL_RWops *rw = SDL_RWFromFile(TEST_INDEX_PATH, "wb");
+
+		SDL_assert_always(rw != NULL);
+		if(len > 0)
+			SDL_RWwrite(rw, file, len, 1);
+		SDL_RWclose(rw);
+
+		if(font_index_load(&loaded) != -1 || loaded.entries != NULL ||
+			loaded.dirs != NULL)
+			failed = SDL_FALSE;
+
+		free_index(&loaded);
+	}
+	lok(failed == SDL_TRUE);
+
+	/* An index saved by another version is ignored. */
+	file[4] = FONT_INDEX_VERSION + 1;
+	{
+		SDL_RWops *rw = SDL_RWFromFile(TEST_INDEX_PATH, "wb");
+
+		SDL_assert_always(rw != NULL);
+		SDL_RWwrite(rw, file, file_sz, 1);
+		SDL_RWclose(rw);
+	}
+	lequal(font_index_load(&loaded), -1);
+	free_index(&loaded);
+
+	SDL_free(file);
+	free_index(&saved);
+	remove(TEST_INDEX_PATH);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+
+	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_CRITICAL);
+
+	lrun("cmap format 4", test_cmap_format4);
+	lrun("cmap format 12", test_cmap_format12);
+	lrun("Collection", test_ttc);
+	lrun("Corrupt sfnt", test_corrupt_sfnt);
+	lrun("Truncated sfnt", test_truncated_sfnt);
+	lrun("Names", test_name);
+#ifdef FONT_INDEX_SCAN
+	lrun("Index file", test_index_round_trip);
+#endif
+	lresults();
+
+	return lfails != 0;
+}